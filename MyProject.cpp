@@ -1,12 +1,40 @@
 #include <GL/glut.h>
+#include <GL/freeglut_ext.h>
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
 #include <cstring>
 #include <cstdio>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #ifdef _WIN32
+#include <winsock2.h>
 #include <windows.h>
+#include <direct.h>
+#include <psapi.h>
+#include <mmsystem.h>
+#pragma comment(lib, "ws2_32.lib")
+#pragma comment(lib, "psapi.lib")
+#pragma comment(lib, "winmm.lib")
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATH_SSE 1
+#include <emmintrin.h>
 #endif
 
 #define MAX_BULLETS 60
@@ -16,10 +44,12 @@
 // Window
 int WIN_W = 1024, WIN_H = 768;
 bool cursorCaptured = true;
-bool ignoreWarp = false;
 
 // Timing
 float lastTime = 0.0f;
+bool pointerInWindow = true;    // glutEntryFunc: where the pointer is, not keyboard focus
+bool windowVisible = true;
+bool showStats = false;
 
 // Camera
 struct Vec3 { float x, y, z; };
@@ -46,50 +76,8 @@ float damageFlash = 0.0f;
 bool gameOver = false;   // ✅ track game-over state
 
 // Environment static props
-struct Rock { Vec3 pos; float scale; };
-Rock rocks[30];
 bool envInitialized = false;
 
-// Systems
-struct Enemy {
-    Vec3 pos;
-    Vec3 dir;
-    float size;
-    float health;
-    bool active;
-    float flashTimer;
-
-    // AI
-    float moveSpeed;
-    float shootCooldown;
-    const float maxShootCooldown = 2.0f;
-    bool canSeePlayer;
-    float lastSeenTime;
-    Vec3 lastSeenPos;
-
-    // Death & respawn
-    float deathTimer; // >0 = dead, counting down to respawn
-};
-
-Enemy enemies[MAX_ENEMIES];
-
-struct Bullet {
-    Vec3 pos;
-    Vec3 dir;
-    bool active;
-    float life;
-    int owner; // 0 = player, 1 = enemy
-};
-Bullet bullets[MAX_BULLETS];
-
-struct Particle {
-    Vec3 pos;
-    Vec3 vel;
-    float life;
-    bool active;
-};
-Particle particles[MAX_PARTICLES];
-
 static GLuint skyTex = 0;
 
 // ---------------------- SOUND HELPERS -------------------------
@@ -126,7 +114,691 @@ Vec3 vecScale(const Vec3& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
 Vec3 vecAdd(const Vec3& a, const Vec3& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
 Vec3 vecSub(const Vec3& a, const Vec3& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
 
+// ---------------------- MATH -------------------------
+// 16-byte aligned types for the CPU transform pipeline. Matrices are
+// column-major like OpenGL, so a Mat4 goes straight into glLoadMatrixf().
+// Vec3 above stays the compact storage type for game state.
+struct alignas(16) Vec4 {
+    float x, y, z, w;
+    constexpr Vec4() : x(0), y(0), z(0), w(0) {}
+    constexpr Vec4(float x_, float y_, float z_, float w_) : x(x_), y(y_), z(z_), w(w_) {}
+};
+
+// Vec3 padded to a full SIMD register
+struct alignas(16) Vec3A {
+    float x, y, z, pad;
+    constexpr Vec3A() : x(0), y(0), z(0), pad(0) {}
+    constexpr Vec3A(float x_, float y_, float z_) : x(x_), y(y_), z(z_), pad(0) {}
+    constexpr Vec3A(const Vec3& v) : x(v.x), y(v.y), z(v.z), pad(0) {}
+};
+
+struct alignas(16) Quat {
+    float x, y, z, w;
+    constexpr Quat() : x(0), y(0), z(0), w(1) {}
+    constexpr Quat(float x_, float y_, float z_, float w_) : x(x_), y(y_), z(z_), w(w_) {}
+};
+
+struct alignas(16) Mat4 {
+    float m[16];
+    constexpr Mat4() : m{ 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 } {}
+    constexpr Mat4(float c0x, float c0y, float c0z, float c0w, float c1x, float c1y, float c1z, float c1w,
+        float c2x, float c2y, float c2z, float c2w, float c3x, float c3y, float c3z, float c3w)
+        : m{ c0x, c0y, c0z, c0w, c1x, c1y, c1z, c1w, c2x, c2y, c2z, c2w, c3x, c3y, c3z, c3w } {}
+};
+
+constexpr Mat4 mat4Identity() { return Mat4(); }
+constexpr Mat4 mat4Translate(float x, float y, float z) { return Mat4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, x, y, z, 1); }
+constexpr Mat4 mat4Scale(float x, float y, float z) { return Mat4(x, 0, 0, 0, 0, y, 0, 0, 0, 0, z, 0, 0, 0, 0, 1); }
+// T * S, the glTranslatef + glScalef pair used by most parts
+constexpr Mat4 mat4TranslateScale(float tx, float ty, float tz, float sx, float sy, float sz) {
+    return Mat4(sx, 0, 0, 0, 0, sy, 0, 0, 0, 0, sz, 0, tx, ty, tz, 1);
+}
+
+// gluOrtho2D equivalent
+constexpr Mat4 mat4Ortho2D(float l, float r, float b, float t) {
+    return Mat4(2.0f / (r - l), 0, 0, 0, 0, 2.0f / (t - b), 0, 0, 0, 0, -1, 0, -(r + l) / (r - l), -(t + b) / (t - b), 0, 1);
+}
+
+// r = a * b
+inline Mat4 mat4Mul(const Mat4& a, const Mat4& b) {
+    Mat4 r;
+#ifdef MATH_SSE
+    __m128 a0 = _mm_load_ps(a.m), a1 = _mm_load_ps(a.m + 4), a2 = _mm_load_ps(a.m + 8), a3 = _mm_load_ps(a.m + 12);
+    for (int j = 0; j < 4; j++) {
+        const float* bc = b.m + j * 4;
+        __m128 c = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+        c = _mm_add_ps(c, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+        c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+        c = _mm_add_ps(c, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+        _mm_store_ps(r.m + j * 4, c);
+    }
+#else
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            r.m[j * 4 + i] = a.m[i] * b.m[j * 4] + a.m[4 + i] * b.m[j * 4 + 1] + a.m[8 + i] * b.m[j * 4 + 2] + a.m[12 + i] * b.m[j * 4 + 3];
+#endif
+    return r;
+}
+
+// m * translate(x, y, z): only the last column changes
+inline Mat4 mat4PostTranslate(const Mat4& m, float x, float y, float z) {
+    Mat4 r = m;
+    for (int i = 0; i < 4; i++) r.m[12 + i] = m.m[i] * x + m.m[4 + i] * y + m.m[8 + i] * z + m.m[12 + i];
+    return r;
+}
+
+inline Vec3A mat4TransformPoint(const Mat4& m, const Vec3A& p) {
+#ifdef MATH_SSE
+    __m128 c = _mm_add_ps(_mm_mul_ps(_mm_load_ps(m.m), _mm_set1_ps(p.x)), _mm_load_ps(m.m + 12));
+    c = _mm_add_ps(c, _mm_mul_ps(_mm_load_ps(m.m + 4), _mm_set1_ps(p.y)));
+    c = _mm_add_ps(c, _mm_mul_ps(_mm_load_ps(m.m + 8), _mm_set1_ps(p.z)));
+    Vec3A r;
+    _mm_store_ps(&r.x, c);
+    r.pad = 0;
+    return r;
+#else
+    return Vec3A(m.m[0] * p.x + m.m[4] * p.y + m.m[8] * p.z + m.m[12],
+        m.m[1] * p.x + m.m[5] * p.y + m.m[9] * p.z + m.m[13],
+        m.m[2] * p.x + m.m[6] * p.y + m.m[10] * p.z + m.m[14]);
+#endif
+}
+
+// Full homogeneous transform (for clip space)
+inline Vec4 mat4TransformVec4(const Mat4& m, const Vec4& v) {
+    Vec4 r;
+#ifdef MATH_SSE
+    __m128 c = _mm_mul_ps(_mm_load_ps(m.m), _mm_set1_ps(v.x));
+    c = _mm_add_ps(c, _mm_mul_ps(_mm_load_ps(m.m + 4), _mm_set1_ps(v.y)));
+    c = _mm_add_ps(c, _mm_mul_ps(_mm_load_ps(m.m + 8), _mm_set1_ps(v.z)));
+    c = _mm_add_ps(c, _mm_mul_ps(_mm_load_ps(m.m + 12), _mm_set1_ps(v.w)));
+    _mm_store_ps(&r.x, c);
+#else
+    r.x = m.m[0] * v.x + m.m[4] * v.y + m.m[8] * v.z + m.m[12] * v.w;
+    r.y = m.m[1] * v.x + m.m[5] * v.y + m.m[9] * v.z + m.m[13] * v.w;
+    r.z = m.m[2] * v.x + m.m[6] * v.y + m.m[10] * v.z + m.m[14] * v.w;
+    r.w = m.m[3] * v.x + m.m[7] * v.y + m.m[11] * v.z + m.m[15] * v.w;
+#endif
+    return r;
+}
+
+// Same convention as glRotatef: degrees, axis need not be normalized
+inline Quat quatAxisAngle(float degrees, float ax, float ay, float az) {
+    float len = sqrtf(ax * ax + ay * ay + az * az);
+    if (len < 1e-6f) return Quat();
+    float half = degrees * 3.14159265f / 360.0f;
+    float s = sinf(half) / len;
+    return Quat(ax * s, ay * s, az * s, cosf(half));
+}
+
+inline Quat quatMul(const Quat& a, const Quat& b) {
+    return Quat(a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+        a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+        a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+        a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+// translate * rotate * scale
+inline Mat4 mat4FromTRS(float tx, float ty, float tz, const Quat& q, float sx, float sy, float sz) {
+    float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+    float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+    float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+    return Mat4((1 - 2 * (yy + zz)) * sx, 2 * (xy + wz) * sx, 2 * (xz - wy) * sx, 0,
+        2 * (xy - wz) * sy, (1 - 2 * (xx + zz)) * sy, 2 * (yz + wx) * sy, 0,
+        2 * (xz + wy) * sz, 2 * (yz - wx) * sz, (1 - 2 * (xx + yy)) * sz, 0,
+        tx, ty, tz, 1);
+}
+
+inline Mat4 mat4Rotate(float degrees, float ax, float ay, float az) {
+    return mat4FromTRS(0, 0, 0, quatAxisAngle(degrees, ax, ay, az), 1, 1, 1);
+}
+
+// gluPerspective equivalent
+inline Mat4 mat4Perspective(float fovyDegrees, float aspect, float zNear, float zFar) {
+    float f = 1.0f / tanf(fovyDegrees * 3.14159265f / 360.0f);
+    return Mat4(f / aspect, 0, 0, 0, 0, f, 0, 0,
+        0, 0, (zFar + zNear) / (zNear - zFar), -1,
+        0, 0, 2.0f * zFar * zNear / (zNear - zFar), 0);
+}
+
+// gluLookAt equivalent, for an already normalized basis
+inline Mat4 mat4View(const Vec3& eye, const Vec3& front, const Vec3& right, const Vec3& up) {
+    return Mat4(right.x, up.x, -front.x, 0,
+        right.y, up.y, -front.y, 0,
+        right.z, up.z, -front.z, 0,
+        -(right.x * eye.x + right.y * eye.y + right.z * eye.z),
+        -(up.x * eye.x + up.y * eye.y + up.z * eye.z),
+        front.x * eye.x + front.y * eye.y + front.z * eye.z, 1);
+}
+
+// out[i] = parent * local[i]; how hierarchies are flattened in bulk each frame
+void mat4MulBatch(const Mat4& parent, const Mat4* local, Mat4* out, int n) {
+    for (int i = 0; i < n; i++) out[i] = mat4Mul(parent, local[i]);
+}
+// --------------------------------------------------------------
+
+// ---------------------- FRAME PACING -------------------------
+// Frames are released on a fixed cadence instead of back-to-back redisplays:
+// a GLUT timer covers the coarse wait (the main loop blocks in the OS, so the
+// core is idle), a high-resolution sleep gets close to the deadline and a
+// short spin-wait lands on it. The spin margin adapts to measured oversleep.
+// Windows ticks sleeps and timers at 15.6 ms by default, so the timer
+// resolution is raised to 1 ms while the game runs; should that fail, the
+// margin may grow to a whole default tick.
+#define DT_HISTORY 8
+#define PACER_MIN_SPIN 0.0005
+#define PACER_MAX_SPIN 0.016
+
+struct FramePacer {
+    float targetFps = 60.0f;    // rate while playing
+    float idleFps = 10.0f;      // rate when paused, game over, unfocused or hidden
+    float activeFps = 0.0f;     // rate currently in effect
+    double spinMargin = 0.002;  // seconds left to busy-wait after sleeping
+    double nextFrame = 0.0;     // deadline for the next display()
+    double lastPresent = 0.0;
+    int timerGeneration = 0;    // stale timers are ignored after a kick
+
+    // dt smoothing
+    float dtHistory[DT_HISTORY];
+    int dtCount = 0, dtIndex = 0;
+
+    // Reporting window (1 s)
+    double windowStart = 0.0, windowCpuStart = 0.0;
+    int windowFrames = 0;
+    double jitterSum = 0.0, jitterMax = 0.0;
+    float fps = 0.0f, jitterAvgMs = 0.0f, jitterMaxMs = 0.0f, cpuPercent = 0.0f;
+};
+FramePacer pacer;
+
+double preciseSeconds() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double processCpuSeconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0.0;
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime; u.HighPart = user.dwHighDateTime;
+    return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+    return clock() / (double)CLOCKS_PER_SEC;
+#endif
+}
+
+// GLUT has no keyboard focus callback. On Windows the thread's active window
+// is checked directly (polled, so regaining focus takes one idle frame).
+// Elsewhere the pointer stands in for focus; a captured pointer never
+// leaves, so there alt-tab only throttles once the window is hidden or
+// fully covered.
+bool windowFocused() {
+#ifdef _WIN32
+    return GetActiveWindow() != 0;
+#else
+    return pointerInWindow;
+#endif
+}
+
+bool pacerIdle() { return gameOver || !cursorCaptured || !windowFocused() || !windowVisible; }
+
+// Average of the last few frame deltas; reset whenever the pacing rate changes
+// so a switch between idle and active rates does not bleed into movement.
+float pacerSmoothDt(float rawDt) {
+    if (rawDt < 0.0f) rawDt = 0.0f;
+    if (rawDt > 0.25f) rawDt = 0.25f; // stalls (window drag, breakpoints) must not teleport anything
+    pacer.dtHistory[pacer.dtIndex] = rawDt;
+    pacer.dtIndex = (pacer.dtIndex + 1) % DT_HISTORY;
+    if (pacer.dtCount < DT_HISTORY) pacer.dtCount++;
+    float sum = 0.0f;
+    for (int i = 0; i < pacer.dtCount; i++) sum += pacer.dtHistory[i];
+    return sum / pacer.dtCount;
+}
+
+void pacerDraw(int generation) {
+    if (generation == pacer.timerGeneration) glutPostRedisplay();
+}
+
+void pacerWake(int generation) {
+    if (generation != pacer.timerGeneration) return;
+    double sleepUntil = pacer.nextFrame - pacer.spinMargin;
+    double before = preciseSeconds();
+    if (sleepUntil > before) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(sleepUntil - before));
+        double overshoot = preciseSeconds() - sleepUntil;
+        if (overshoot < 0.0) overshoot = 0.0;
+        double margin = pacer.spinMargin * 0.9 + (overshoot * 1.5 + 0.0002) * 0.1;
+        pacer.spinMargin = margin < PACER_MIN_SPIN ? PACER_MIN_SPIN : (margin > PACER_MAX_SPIN ? PACER_MAX_SPIN : margin);
+    }
+    while (preciseSeconds() < pacer.nextFrame) std::this_thread::yield();
+    // One more pass through the main loop first, so input that arrived while
+    // we slept is dispatched before the frame starts
+    glutTimerFunc(0, pacerDraw, generation);
+}
+
+#ifdef _WIN32
+void pacerRestoreTimer() { timeEndPeriod(1); }
+#endif
+
+// Call once at startup
+void pacerInit() {
+#ifdef _WIN32
+    if (timeBeginPeriod(1) == TIMERR_NOERROR) atexit(pacerRestoreTimer);
+#endif
+}
+
+// Call after glutSwapBuffers(): records pacing stats and schedules the next frame.
+void pacerFramePresented() {
+    double now = preciseSeconds();
+    float rate = pacerIdle() ? pacer.idleFps : pacer.targetFps;
+    double period = 1.0 / rate;
+
+    if (rate != pacer.activeFps) {
+        pacer.activeFps = rate;
+        pacer.dtCount = 0;
+        pacer.nextFrame = now;
+    }
+    else if (pacer.lastPresent > 0.0) {
+        double jitter = fabs((now - pacer.lastPresent) - period);
+        pacer.jitterSum += jitter;
+        if (jitter > pacer.jitterMax) pacer.jitterMax = jitter;
+    }
+    pacer.lastPresent = now;
+    pacer.windowFrames++;
+
+    if (now - pacer.windowStart >= 1.0) {
+        double cpu = processCpuSeconds();
+        double span = now - pacer.windowStart;
+        pacer.fps = (float)(pacer.windowFrames / span);
+        pacer.jitterAvgMs = (float)(pacer.jitterSum / pacer.windowFrames * 1000.0);
+        pacer.jitterMaxMs = (float)(pacer.jitterMax * 1000.0);
+        pacer.cpuPercent = (float)((cpu - pacer.windowCpuStart) / span * 100.0);
+        pacer.windowStart = now;
+        pacer.windowCpuStart = cpu;
+        pacer.windowFrames = 0;
+        pacer.jitterSum = pacer.jitterMax = 0.0;
+    }
+
+    pacer.nextFrame += period;
+    if (pacer.nextFrame < now) pacer.nextFrame = now; // fell behind: don't try to catch up
+    double wait = pacer.nextFrame - now - pacer.spinMargin;
+    glutTimerFunc(wait > 0.0 ? (unsigned)(wait * 1000.0) : 0, pacerWake, pacer.timerGeneration);
+}
+
+// Redraw right away, e.g. when leaving an idle state, instead of waiting out
+// an idle-rate timer that is already pending.
+void pacerKick() {
+    pacer.timerGeneration++;
+    pacer.nextFrame = preciseSeconds();
+    glutPostRedisplay();
+}
+// --------------------------------------------------------------
+
+// ---------------------- INPUT -------------------------
+// GLUT callbacks only record timestamped events; the frame consumes them.
+// Keys and buttons are handled in order at the start of the frame, mouse
+// look is accumulated and applied once, right before the view matrix is
+// built (late latching), with a single pointer warp per frame.
+// Every consumed event is timed to the buffer swap of the frame that used
+// it; percentiles over the last LATENCY_SAMPLES frames are refreshed once a
+// second.
+#define MAX_INPUT_EVENTS 256
+#define LATENCY_SAMPLES 512
+
+enum InputEventType { INPUT_MOUSE_MOVE, INPUT_KEY_DOWN, INPUT_KEY_UP, INPUT_BUTTON_DOWN };
+
+struct InputEvent {
+    double time;
+    int type;
+    int a, b;            // mouse delta, or key and 0, or button
+    int modifiers;       // glutGetModifiers(), only valid inside the callback
+};
+
+struct LatencyTracker {
+    float samples[LATENCY_SAMPLES];   // ms, one per frame that consumed input
+    int count = 0, next = 0;
+    float p50 = 0.0f, p95 = 0.0f, p99 = 0.0f, max = 0.0f;
+};
+
+struct InputQueue {
+    InputEvent events[MAX_INPUT_EVENTS];
+    int head = 0, count = 0, dropped = 0;
+    int lastX = -1, lastY = -1;             // pointer position of the previous motion event
+    int modifiers = 0;                      // as of the latest event
+
+    // Frame in progress
+    float lookDx = 0.0f, lookDy = 0.0f;     // pixels, not yet applied
+    bool warpPending = false;
+    bool warpInFlight = false;              // warped, its motion event not seen yet
+    int warpX = 0, warpY = 0, warpFrames = 0;
+    double oldestEvent = 0.0, oldestLook = 0.0;   // 0 = none this frame
+    int frameEvents = 0;
+
+    LatencyTracker any, look;
+    double lastReport = 0.0;
+    float eventsPerFrame = 0.0f;
+    int reportFrames = 0, reportEvents = 0;
+};
+InputQueue input;
+
+void pushInput(int type, int a, int b, int modifiers) {
+    if (input.count >= MAX_INPUT_EVENTS) { input.dropped++; return; }
+    InputEvent& e = input.events[(input.head + input.count) % MAX_INPUT_EVENTS];
+    e.time = preciseSeconds();
+    e.type = type;
+    e.a = a;
+    e.b = b;
+    e.modifiers = modifiers;
+    input.count++;
+}
+
+bool popInput(InputEvent& e) {
+    if (input.count == 0) return false;
+    e = input.events[input.head];
+    input.head = (input.head + 1) % MAX_INPUT_EVENTS;
+    input.count--;
+    return true;
+}
+
+void latencySample(LatencyTracker& t, float ms) {
+    t.samples[t.next] = ms;
+    t.next = (t.next + 1) % LATENCY_SAMPLES;
+    if (t.count < LATENCY_SAMPLES) t.count++;
+}
+
+void latencyPercentiles(LatencyTracker& t) {
+    if (t.count == 0) return;
+    float sorted[LATENCY_SAMPLES];
+    memcpy(sorted, t.samples, sizeof(float) * t.count);
+    std::sort(sorted, sorted + t.count);
+    t.p50 = sorted[(t.count - 1) * 50 / 100];
+    t.p95 = sorted[(t.count - 1) * 95 / 100];
+    t.p99 = sorted[(t.count - 1) * 99 / 100];
+    t.max = sorted[t.count - 1];
+}
+
+// Call right after glutSwapBuffers().
+void inputFramePresented() {
+    double now = preciseSeconds();
+    if (input.oldestEvent > 0.0) latencySample(input.any, (float)((now - input.oldestEvent) * 1000.0));
+    if (input.oldestLook > 0.0) latencySample(input.look, (float)((now - input.oldestLook) * 1000.0));
+    input.reportEvents += input.frameEvents;
+    input.reportFrames++;
+    input.oldestEvent = input.oldestLook = 0.0;
+    input.frameEvents = 0;
+
+    if (now - input.lastReport >= 1.0) {
+        latencyPercentiles(input.any);
+        latencyPercentiles(input.look);
+        input.eventsPerFrame = input.reportFrames ? (float)input.reportEvents / input.reportFrames : 0.0f;
+        input.reportEvents = input.reportFrames = 0;
+        input.lastReport = now;
+    }
+}
+// --------------------------------------------------------------
+
+// ---------------------- DYNAMIC RESOLUTION -------------------------
+// The 3D scene is drawn into an offscreen color+depth target whose size is
+// renderScale * window, then stretched over the window; HUD, damage flash and
+// gun are drawn afterwards at native resolution. The scale follows the
+// measured frame time against a budget, stepping down fast and back up slowly
+// so it does not oscillate. Frame time is the larger of the CPU's time in
+// display() and the GPU's, read from timer queries a frame or more late so
+// the CPU never waits for the GPU; only without timer queries (old drivers,
+// some software renderers) does it fall back to glFinish().
+// Without framebuffer objects the scene goes to a corner of the back buffer
+// and is copied into the texture instead (plain GL 1.1, always available).
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#define GL_FRAMEBUFFER_ID 0x8D40
+#define GL_RENDERBUFFER_ID 0x8D41
+#define GL_COLOR_ATTACHMENT0_ID 0x8CE0
+#define GL_DEPTH_ATTACHMENT_ID 0x8D00
+#define GL_FRAMEBUFFER_COMPLETE_ID 0x8CD5
+#define GL_DEPTH_COMPONENT24_ID 0x81A6
+#define GL_TIME_ELAPSED_ID 0x88BF
+#define GL_QUERY_RESULT_ID 0x8866
+#define GL_QUERY_RESULT_AVAILABLE_ID 0x8867
+#define GPU_TIMER_QUERIES 4
+
+typedef void (APIENTRY* GenObjectsProc)(GLsizei, GLuint*);
+typedef void (APIENTRY* BindObjectProc)(GLenum, GLuint);
+typedef void (APIENTRY* FramebufferTexture2DProc)(GLenum, GLenum, GLenum, GLuint, GLint);
+typedef void (APIENTRY* RenderbufferStorageProc)(GLenum, GLenum, GLsizei, GLsizei);
+typedef void (APIENTRY* FramebufferRenderbufferProc)(GLenum, GLenum, GLenum, GLuint);
+typedef GLenum(APIENTRY* CheckFramebufferStatusProc)(GLenum);
+typedef void (APIENTRY* EndQueryProc)(GLenum);
+typedef void (APIENTRY* GetQueryObjectivProc)(GLuint, GLenum, GLint*);
+typedef void (APIENTRY* GetQueryObjectui64vProc)(GLuint, GLenum, uint64_t*);
+
+struct DynamicResolution {
+    bool enabled = true;
+    float scale = 1.0f;
+    const float minScale = 0.5f, maxScale = 1.0f;
+    float budgetMs = 0.0f;       // 0 = derive from the pacer's target rate
+    float frameMs = 0.0f;        // smoothed measured frame time
+    int overFrames = 0, underFrames = 0;
+    int budgetHits = 0, budgetHitsLastSecond = 0, budgetHitsThisSecond = 0;
+    double hitWindowStart = 0.0;
+    int sceneW = 0, sceneH = 0;  // size the scene was rendered at this frame
+
+    // Offscreen target
+    bool useFbo = false, checked = false;
+    GLuint fbo = 0, depthRb = 0, colorTex = 0;
+    int texW = 0, texH = 0;
+    bool dirty = true;           // reallocate after reshape
+
+    GenObjectsProc genFramebuffers = 0, genRenderbuffers = 0;
+    BindObjectProc bindFramebuffer = 0, bindRenderbuffer = 0;
+    FramebufferTexture2DProc framebufferTexture2D = 0;
+    RenderbufferStorageProc renderbufferStorage = 0;
+    FramebufferRenderbufferProc framebufferRenderbuffer = 0;
+    CheckFramebufferStatusProc checkFramebufferStatus = 0;
+
+    // GPU timer queries, a small ring read back oldest first
+    bool timersChecked = false, timers = false, timing = false;
+    GLuint queries[GPU_TIMER_QUERIES];
+    int queryNext = 0, queryPending = 0;
+    float gpuMs = 0.0f;          // latest result, a frame or more old
+    GenObjectsProc genQueries = 0;
+    BindObjectProc beginQuery = 0;
+    EndQueryProc endQuery = 0;
+    GetQueryObjectivProc getQueryObjectiv = 0;
+    GetQueryObjectui64vProc getQueryObjectui64v = 0;
+};
+DynamicResolution dynRes;
+
+void* glProc(const char* core, const char* ext) {
+    void* p = (void*)glutGetProcAddress(core);
+    return p ? p : (void*)glutGetProcAddress(ext);
+}
+
+void dynResLoadFbo() {
+    dynRes.checked = true;
+    const char* exts = (const char*)glGetString(GL_EXTENSIONS);
+    const char* version = (const char*)glGetString(GL_VERSION);
+    bool supported = (version && atoi(version) >= 3) || (exts && strstr(exts, "GL_EXT_framebuffer_object"));
+    if (!supported) return;
+    dynRes.genFramebuffers = (GenObjectsProc)glProc("glGenFramebuffers", "glGenFramebuffersEXT");
+    dynRes.genRenderbuffers = (GenObjectsProc)glProc("glGenRenderbuffers", "glGenRenderbuffersEXT");
+    dynRes.bindFramebuffer = (BindObjectProc)glProc("glBindFramebuffer", "glBindFramebufferEXT");
+    dynRes.bindRenderbuffer = (BindObjectProc)glProc("glBindRenderbuffer", "glBindRenderbufferEXT");
+    dynRes.framebufferTexture2D = (FramebufferTexture2DProc)glProc("glFramebufferTexture2D", "glFramebufferTexture2DEXT");
+    dynRes.renderbufferStorage = (RenderbufferStorageProc)glProc("glRenderbufferStorage", "glRenderbufferStorageEXT");
+    dynRes.framebufferRenderbuffer = (FramebufferRenderbufferProc)glProc("glFramebufferRenderbuffer", "glFramebufferRenderbufferEXT");
+    dynRes.checkFramebufferStatus = (CheckFramebufferStatusProc)glProc("glCheckFramebufferStatus", "glCheckFramebufferStatusEXT");
+    dynRes.useFbo = dynRes.genFramebuffers && dynRes.genRenderbuffers && dynRes.bindFramebuffer &&
+        dynRes.bindRenderbuffer && dynRes.framebufferTexture2D && dynRes.renderbufferStorage &&
+        dynRes.framebufferRenderbuffer && dynRes.checkFramebufferStatus;
+}
+
+int nextPow2(int v) { int p = 1; while (p < v) p <<= 1; return p; }
+
+void dynResAllocate() {
+    if (!dynRes.checked) dynResLoadFbo();
+    dynRes.dirty = false;
+    dynRes.texW = dynRes.useFbo ? WIN_W : nextPow2(WIN_W);
+    dynRes.texH = dynRes.useFbo ? WIN_H : nextPow2(WIN_H);
+
+    if (!dynRes.colorTex) glGenTextures(1, &dynRes.colorTex);
+    glBindTexture(GL_TEXTURE_2D, dynRes.colorTex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, dynRes.texW, dynRes.texH, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, 0x812F);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, 0x812F);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (!dynRes.useFbo) return;
+
+    if (!dynRes.fbo) dynRes.genFramebuffers(1, &dynRes.fbo);
+    if (!dynRes.depthRb) dynRes.genRenderbuffers(1, &dynRes.depthRb);
+    dynRes.bindRenderbuffer(GL_RENDERBUFFER_ID, dynRes.depthRb);
+    dynRes.renderbufferStorage(GL_RENDERBUFFER_ID, GL_DEPTH_COMPONENT24_ID, dynRes.texW, dynRes.texH);
+    dynRes.bindRenderbuffer(GL_RENDERBUFFER_ID, 0);
+    dynRes.bindFramebuffer(GL_FRAMEBUFFER_ID, dynRes.fbo);
+    dynRes.framebufferTexture2D(GL_FRAMEBUFFER_ID, GL_COLOR_ATTACHMENT0_ID, GL_TEXTURE_2D, dynRes.colorTex, 0);
+    dynRes.framebufferRenderbuffer(GL_FRAMEBUFFER_ID, GL_DEPTH_ATTACHMENT_ID, GL_RENDERBUFFER_ID, dynRes.depthRb);
+    if (dynRes.checkFramebufferStatus(GL_FRAMEBUFFER_ID) != GL_FRAMEBUFFER_COMPLETE_ID) {
+        printf("Offscreen framebuffer incomplete, falling back to copy-to-texture\n");
+        dynRes.useFbo = false;
+        dynRes.texW = nextPow2(WIN_W);
+        dynRes.texH = nextPow2(WIN_H);
+        glBindTexture(GL_TEXTURE_2D, dynRes.colorTex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, dynRes.texW, dynRes.texH, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    dynRes.bindFramebuffer(GL_FRAMEBUFFER_ID, 0);
+}
+
+// Sets up the target and viewport for the 3D scene. Projection keeps using the
+// window aspect, so only the pixel count changes.
+void beginScene() {
+    if (!dynRes.enabled) {
+        dynRes.sceneW = WIN_W; dynRes.sceneH = WIN_H;
+        glViewport(0, 0, WIN_W, WIN_H);
+        return;
+    }
+    if (dynRes.dirty) dynResAllocate();
+    dynRes.sceneW = (int)(WIN_W * dynRes.scale);
+    dynRes.sceneH = (int)(WIN_H * dynRes.scale);
+    if (dynRes.sceneW < 1) dynRes.sceneW = 1;
+    if (dynRes.sceneH < 1) dynRes.sceneH = 1;
+    if (dynRes.useFbo) dynRes.bindFramebuffer(GL_FRAMEBUFFER_ID, dynRes.fbo);
+    glViewport(0, 0, dynRes.sceneW, dynRes.sceneH);
+}
+
+// Stretches the scene over the whole window.
+void endScene() {
+    if (!dynRes.enabled) return;
+    if (dynRes.useFbo) dynRes.bindFramebuffer(GL_FRAMEBUFFER_ID, 0);
+    else {
+        glBindTexture(GL_TEXTURE_2D, dynRes.colorTex);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, dynRes.sceneW, dynRes.sceneH);
+    }
+    glViewport(0, 0, WIN_W, WIN_H);
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_FOG);
+    glEnable(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, dynRes.colorTex);
+    glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity(); gluOrtho2D(0, 1, 0, 1);
+    glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
+    float u = dynRes.sceneW / (float)dynRes.texW, v = dynRes.sceneH / (float)dynRes.texH;
+    glColor3f(1, 1, 1);
+    glBegin(GL_QUADS);
+    glTexCoord2f(0, 0); glVertex2f(0, 0);
+    glTexCoord2f(u, 0); glVertex2f(1, 0);
+    glTexCoord2f(u, v); glVertex2f(1, 1);
+    glTexCoord2f(0, v); glVertex2f(0, 1);
+    glEnd();
+    glPopMatrix(); glMatrixMode(GL_PROJECTION); glPopMatrix(); glMatrixMode(GL_MODELVIEW);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_TEXTURE_2D);
+    glEnable(GL_DEPTH_TEST);
+}
+
+void gpuTimerLoad() {
+    dynRes.timersChecked = true;
+    const char* exts = (const char*)glGetString(GL_EXTENSIONS);
+    const char* version = (const char*)glGetString(GL_VERSION);
+    bool core = version && (atoi(version) > 3 || (atoi(version) == 3 && strchr(version, '.') && atoi(strchr(version, '.') + 1) >= 3));
+    bool supported = core || (exts && (strstr(exts, "GL_ARB_timer_query") || strstr(exts, "GL_EXT_timer_query")));
+    if (!supported) return;
+    dynRes.genQueries = (GenObjectsProc)glProc("glGenQueries", "glGenQueriesARB");
+    dynRes.beginQuery = (BindObjectProc)glProc("glBeginQuery", "glBeginQueryARB");
+    dynRes.endQuery = (EndQueryProc)glProc("glEndQuery", "glEndQueryARB");
+    dynRes.getQueryObjectiv = (GetQueryObjectivProc)glProc("glGetQueryObjectiv", "glGetQueryObjectivARB");
+    dynRes.getQueryObjectui64v = (GetQueryObjectui64vProc)glProc("glGetQueryObjectui64v", "glGetQueryObjectui64vEXT");
+    dynRes.timers = dynRes.genQueries && dynRes.beginQuery && dynRes.endQuery && dynRes.getQueryObjectiv && dynRes.getQueryObjectui64v;
+    if (dynRes.timers) dynRes.genQueries(GPU_TIMER_QUERIES, dynRes.queries);
+}
+
+// Brackets the frame's GL work. Skipped while every query is still in flight.
+void gpuTimerBegin() {
+    if (!dynRes.timersChecked) gpuTimerLoad();
+    dynRes.timing = dynRes.timers && dynRes.queryPending < GPU_TIMER_QUERIES;
+    if (dynRes.timing) dynRes.beginQuery(GL_TIME_ELAPSED_ID, dynRes.queries[dynRes.queryNext]);
+}
+
+// Collects whatever results are ready without waiting. Returns the latest GPU
+// time in ms, or -1 when there are no timer queries.
+float gpuTimerEnd() {
+    if (!dynRes.timers) return -1.0f;
+    if (dynRes.timing) {
+        dynRes.endQuery(GL_TIME_ELAPSED_ID);
+        dynRes.queryNext = (dynRes.queryNext + 1) % GPU_TIMER_QUERIES;
+        dynRes.queryPending++;
+        dynRes.timing = false;
+    }
+    while (dynRes.queryPending > 0) {
+        GLuint q = dynRes.queries[(dynRes.queryNext + GPU_TIMER_QUERIES - dynRes.queryPending) % GPU_TIMER_QUERIES];
+        GLint available = 0;
+        dynRes.getQueryObjectiv(q, GL_QUERY_RESULT_AVAILABLE_ID, &available);
+        if (!available) break;
+        uint64_t ns = 0;
+        dynRes.getQueryObjectui64v(q, GL_QUERY_RESULT_ID, &ns);
+        dynRes.gpuMs = (float)(ns / 1e6);
+        dynRes.queryPending--;
+    }
+    return dynRes.gpuMs;
+}
+
+// Feed the frame's work time into the controller.
+void dynResUpdate(float workMs) {
+    float budget = dynRes.budgetMs > 0.0f ? dynRes.budgetMs : 1000.0f / pacer.targetFps * 0.8f;
+    dynRes.frameMs = dynRes.frameMs == 0.0f ? workMs : dynRes.frameMs * 0.9f + workMs * 0.1f;
+
+    if (workMs > budget) { dynRes.budgetHits++; dynRes.budgetHitsThisSecond++; }
+    double now = preciseSeconds();
+    if (now - dynRes.hitWindowStart >= 1.0) {
+        dynRes.budgetHitsLastSecond = dynRes.budgetHitsThisSecond;
+        dynRes.budgetHitsThisSecond = 0;
+        dynRes.hitWindowStart = now;
+    }
+    if (!dynRes.enabled) return;
+
+    dynRes.overFrames = dynRes.frameMs > budget ? dynRes.overFrames + 1 : 0;
+    dynRes.underFrames = dynRes.frameMs < budget * 0.7f ? dynRes.underFrames + 1 : 0;
+    if (dynRes.overFrames >= 10 && dynRes.scale > dynRes.minScale) {
+        dynRes.scale -= 0.1f;
+        if (dynRes.scale < dynRes.minScale) dynRes.scale = dynRes.minScale;
+        dynRes.overFrames = 0;
+        dynRes.frameMs = budget; // let the new scale settle before judging it
+    }
+    else if (dynRes.underFrames >= 60 && dynRes.scale < dynRes.maxScale) {
+        dynRes.scale += 0.05f;
+        if (dynRes.scale > dynRes.maxScale) dynRes.scale = dynRes.maxScale;
+        dynRes.underFrames = 0;
+    }
+}
+// --------------------------------------------------------------
+
 // Camera
+Mat4 viewMatrix, projMatrix;
+bool projDirty = true;
+
 void updateCameraVectors() {
     float yr = yaw * 3.14159265f / 180.0f;
     float pr = pitch * 3.14159265f / 180.0f;
@@ -135,52 +807,14 @@ void updateCameraVectors() {
     camRight = vecCross(camFront, Vec3{ 0,1,0 }); vecNormalize(camRight);
     camUp = vecCross(camRight, camFront); vecNormalize(camUp);
 }
-void applyView() {
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    gluLookAt(camPos.x, camPos.y, camPos.z,
-        camPos.x + camFront.x, camPos.y + camFront.y, camPos.z + camFront.z,
-        camUp.x, camUp.y, camUp.z);
-}
-
-// Sky texture
-void makeSkyTexture() {
-    const int TEX_SIZE = 256;
-    static bool done = false;
-    if (done) return;
-    unsigned char pixels[TEX_SIZE][TEX_SIZE][3];
-    for (int y = 0; y < TEX_SIZE; ++y) {
-        float t = y / (float)(TEX_SIZE - 1);
-        float r, g, b;
-        if (t < 0.5f) {
-            float s = t * 2.0f;
-            r = 0.1f + 0.3f * s;
-            g = 0.2f + 0.4f * s;
-            b = 0.5f + 0.4f * s;
-        }
-        else {
-            float s = (t - 0.5f) * 2.0f;
-            r = 0.4f + 0.5f * s;
-            g = 0.6f + 0.3f * s;
-            b = 0.9f + 0.05f * s;
-        }
-        unsigned char R = (unsigned char)(r * 255);
-        unsigned char G = (unsigned char)(g * 255);
-        unsigned char B = (unsigned char)(b * 255);
-        for (int x = 0; x < TEX_SIZE; ++x) {
-            pixels[y][x][0] = R;
-            pixels[y][x][1] = G;
-            pixels[y][x][2] = B;
-        }
-    }
-    glGenTextures(1, &skyTex);
-    glBindTexture(GL_TEXTURE_2D, skyTex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, TEX_SIZE, TEX_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, 0x812F);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, 0x812F);
-    done = true;
+void updateViewMatrix() {
+    viewMatrix = mat4View(camPos, camFront, camRight, camUp);
+}
+// Rebuilt only when the window aspect changes
+void updateProjectionMatrix() {
+    if (!projDirty) return;
+    projMatrix = mat4Perspective(70.0f, (float)WIN_W / (float)WIN_H, 0.1f, 300.0f);
+    projDirty = false;
 }
 
 // Terrain height
@@ -188,175 +822,2738 @@ float terrainHeight(float x, float z) {
     return 2.0f + 1.5f * sinf(x * 0.05f) * cosf(z * 0.07f) + 0.8f * sinf((x + z) * 0.1f);
 }
 
-// Draw helpers
-void drawRock(const Vec3& pos, float scale) {
-    glColor3f(0.35f, 0.30f, 0.25f);
-    glPushMatrix();
-    glTranslatef(pos.x, pos.y, pos.z);
-    glScalef(scale, scale * 0.7f, scale);
-    glutSolidSphere(1.0f, 8, 8);
-    glPopMatrix();
+// The sun is fixed, at this offset from the eye
+const float SUN_ANGLE = 0.8f;
+Vec3 sunOffset() { return { cosf(SUN_ANGLE) * 120.0f, 80.0f + sinf(SUN_ANGLE) * 60.0f, sinf(SUN_ANGLE) * 120.0f }; }
+
+// ---------------------- MODELS -------------------------
+// Every multi-part model is a flat list of part transforms relative to its
+// owner. Constant parts are composed once here; per-frame matrices are built
+// in bulk by transformScene(), so draw code only loads finished modelview
+// matrices instead of pushing/translating/rotating/scaling per part.
+enum ShapeKind { SHAPE_SPHERE, SHAPE_CUBE, SHAPE_CONE };
+
+struct PartShape {
+    int shape;
+    float size, height;  // sphere radius / cube edge / cone base radius; cone height
+    int slices, stacks;
+    Vec3 color;
+    bool flashes;        // uses the owner's hit-flash color
+};
+
+#define ENEMY_PARTS 7
+#define GUN_PARTS 4
+
+Mat4 enemyPartLocal[ENEMY_PARTS];
+PartShape enemyPartShape[ENEMY_PARTS];
+Mat4 gunPartView[GUN_PARTS];       // view space, the gun follows the camera
+PartShape gunPartShape[GUN_PARTS];
+Mat4 gunMuzzleView;
+
+// Per-frame transform pass output not owned by an entity
+Mat4 skyModelView, sunModelView;
+
+PartShape makeShape(int shape, float size, float height, int slices, int stacks, Vec3 color, bool flashes = false) {
+    PartShape s = { shape, size, height, slices, stacks, color, flashes };
+    return s;
 }
 
-void drawGun() {
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
-
-    glTranslatef(0.3f, -0.2f, -0.5f);
-    glRotatef(-5.0f, 1, 0, 0);
-    glRotatef(8.0f, 0, 0, 1);
-
-    // Barrel — using glutSolidCone (safe for all GLUT)
-    glColor3f(0.15f, 0.15f, 0.15f);
-    glPushMatrix();
-    glTranslatef(0, 0, -0.6f);
-    glRotatef(90, 1, 0, 0); // point along Z
-    glutSolidCone(0.06f, 0.8f, 8, 4); // ✅ safe
-    glPopMatrix();
-
-    // Body
-    glPushMatrix();
-    glTranslatef(0.0f, -0.15f, -0.3f);
-    glScalef(0.1f, 0.3f, 0.4f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
-
-    // Stock
-    glColor3f(0.2f, 0.15f, 0.1f);
-    glPushMatrix();
-    glTranslatef(0.0f, -0.05f, 0.1f);
-    glScalef(0.08f, 0.1f, 0.3f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
-
-    // Magazine
-    glColor3f(0.1f, 0.1f, 0.1f);
-    glPushMatrix();
-    glTranslatef(0.0f, -0.3f, -0.3f);
-    glScalef(0.06f, 0.2f, 0.1f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
+void initModels() {
+    const Vec3 skin = { 0.8f, 0.3f, 0.3f };
+    enemyPartLocal[0] = mat4Translate(0, 1.5f, 0);                                   // head
+    enemyPartShape[0] = makeShape(SHAPE_SPHERE, 0.2f, 0, 8, 8, skin, true);
+    enemyPartLocal[1] = mat4TranslateScale(0, 0.9f, 0, 0.4f, 0.8f, 0.3f);           // body
+    enemyPartShape[1] = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.2f, 0.2f, 0.6f });
+    enemyPartLocal[2] = mat4TranslateScale(0.3f, 1.1f, 0, 0.2f, 0.6f, 0.2f);        // arms
+    enemyPartShape[2] = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, skin);
+    enemyPartLocal[3] = mat4TranslateScale(-0.3f, 1.1f, 0, 0.2f, 0.6f, 0.2f);
+    enemyPartShape[3] = enemyPartShape[2];
+    enemyPartLocal[4] = mat4TranslateScale(0.15f, 0.3f, 0, 0.2f, 0.6f, 0.2f);       // legs
+    enemyPartShape[4] = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.1f, 0.1f, 0.4f });
+    enemyPartLocal[5] = mat4TranslateScale(-0.15f, 0.3f, 0, 0.2f, 0.6f, 0.2f);
+    enemyPartShape[5] = enemyPartShape[4];
+    enemyPartLocal[6] = mat4FromTRS(0.4f, 1.0f, 0, quatAxisAngle(-20, 0, 0, 1), 0.05f, 0.3f, 0.05f); // gun
+    enemyPartShape[6] = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.1f, 0.1f, 0.1f });
 
-    // Muzzle flash
-    static float lastFireTime = -10.0f;
-    if (justFired) {
-        lastFireTime = lastTime;
-        justFired = false;
-    }
-    if (lastTime - lastFireTime < 0.08f) {
-        float alpha = 1.0f - (lastTime - lastFireTime) / 0.08f;
-        glColor4f(1.0f, 0.7f, 0.2f, alpha * 0.9f);
-        glPushMatrix();
-        glTranslatef(0, 0, -0.95f);
-        float size = 0.1f + 0.2f * sinf(lastTime * 200.0f);
-        glutSolidSphere(size, 6, 6);
-        glPopMatrix();
-    }
+    Mat4 gunBase = mat4FromTRS(0.3f, -0.2f, -0.5f, quatMul(quatAxisAngle(-5, 1, 0, 0), quatAxisAngle(8, 0, 0, 1)), 1, 1, 1);
+    gunPartView[0] = mat4Mul(gunBase, mat4FromTRS(0, 0, -0.6f, quatAxisAngle(90, 1, 0, 0), 1, 1, 1)); // barrel, along Z
+    gunPartShape[0] = makeShape(SHAPE_CONE, 0.06f, 0.8f, 8, 4, { 0.15f, 0.15f, 0.15f });
+    gunPartView[1] = mat4Mul(gunBase, mat4TranslateScale(0.0f, -0.15f, -0.3f, 0.1f, 0.3f, 0.4f)); // body
+    gunPartShape[1] = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.15f, 0.15f, 0.15f });
+    gunPartView[2] = mat4Mul(gunBase, mat4TranslateScale(0.0f, -0.05f, 0.1f, 0.08f, 0.1f, 0.3f)); // stock
+    gunPartShape[2] = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.2f, 0.15f, 0.1f });
+    gunPartView[3] = mat4Mul(gunBase, mat4TranslateScale(0.0f, -0.3f, -0.3f, 0.06f, 0.2f, 0.1f)); // magazine
+    gunPartShape[3] = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.1f, 0.1f, 0.1f });
+    gunMuzzleView = mat4Mul(gunBase, mat4Translate(0, 0, -0.95f));
+}
 
-    glPopMatrix();
+void drawShape(const PartShape& s) {
+    if (s.shape == SHAPE_SPHERE) glutSolidSphere(s.size, s.slices, s.stacks);
+    else if (s.shape == SHAPE_CUBE) glutSolidCube(s.size);
+    else glutSolidCone(s.size, s.height, s.slices, s.stacks);
 }
+// --------------------------------------------------------------
 
-// Draw
-void drawSkydome() {
-    const float sunAngle = 0.8f;
-    float sunX = cosf(sunAngle) * 120.0f;
-    float sunY = 80.0f + sinf(sunAngle) * 60.0f;
-    float sunZ = sinf(sunAngle) * 120.0f;
-
-    glPushMatrix();
-    glTranslatef(camPos.x, 0, camPos.z);
-    glDisable(GL_LIGHTING);
-    glEnable(GL_TEXTURE_2D);
-    makeSkyTexture();
-    glBindTexture(GL_TEXTURE_2D, skyTex);
-    glColor3f(1, 1, 1);
+// ---------------------- OCCLUSION -------------------------
+// CPU visibility pass, run once per frame before anything is submitted.
+// From the eye position it builds
+//  - a horizon map: per azimuth bin, the steepest slope the terrain rises to,
+//    kept in distance layers so an object is only tested against terrain
+//    that is nearer than it;
+//  - a coarse software depth buffer with the big occluders (the building,
+//    the hills around the player) rasterized into it.
+// Terrain sectors, props and enemies are then tested with world-space boxes.
+// Both tests are conservative: an object is hidden only when every bin or
+// pixel it could touch is covered by something in front of it.
+#define TERRAIN_HALF 100.0f
+#define TERRAIN_STEP 2.0f
+#define TERRAIN_CELLS 100               // per side
+#define TERRAIN_SECTORS 10              // per side
+#define SECTOR_CELLS (TERRAIN_CELLS / TERRAIN_SECTORS)
+#define HORIZON_BINS 256
+#define HORIZON_LAYERS 7
+#define OCC_W 128
+#define OCC_H 64
+#define OCC_TERRAIN_RADIUS 24.0f        // terrain rasterized into the depth buffer
+#define OCC_MIN_OCCLUDER 2.0f           // smallest box edge worth rasterizing
+#define MAX_OCCLUDERS 16
 
-    const int seg = 32;
-    const float R = 150.0f;
-    for (int i = 0; i < seg; ++i) {
-        float theta1 = (i / float(seg)) * 3.14159f * 0.5f;
-        float theta2 = ((i + 1) / float(seg)) * 3.14159f * 0.5f;
-        glBegin(GL_TRIANGLE_STRIP);
-        for (int j = 0; j <= seg * 2; ++j) {
-            float phi = (j / float(seg * 2)) * 6.28318f;
-            for (int t = 0; t < 2; ++t) {
-                float th = (t == 0 ? theta1 : theta2);
-                float x = R * cosf(th) * cosf(phi);
-                float y = R * sinf(th);
-                float z = R * cosf(th) * sinf(phi);
-                float v = th / (3.14159f * 0.5f);
-                float u = phi / 6.28318f;
-                glTexCoord2f(u, v);
-                glVertex3f(x, y, z);
-            }
+struct Bounds { Vec3 min, max; };
+
+enum OccludeeKind { OCCLUDEE_SECTOR, OCCLUDEE_PROP, OCCLUDEE_ENEMY, OCCLUDEE_KINDS };
+enum OcclusionResult { OCC_VISIBLE, OCC_HORIZON, OCC_DEPTH, OCC_OUTSIDE };
+
+struct OcclusionStats {
+    int tested[OCCLUDEE_KINDS], hidden[OCCLUDEE_KINDS];
+    int byHorizon, byDepth, outsideView;
+    double buildMs;
+};
+
+struct Occlusion {
+    bool enabled = true;
+    Vec3 eye;
+    Mat4 viewProj;
+    float horizon[HORIZON_LAYERS][HORIZON_BINS];  // slope, each layer includes the nearer ones
+    float depth[OCC_H][OCC_W];                     // NDC z, 1 = far plane
+    Bounds occluders[MAX_OCCLUDERS];
+    int occluderCount = 0;
+    OcclusionStats frame;
+};
+Occlusion occlusion;
+
+// Occluders in horizon layer k are entirely nearer than this
+const float horizonLayerRadius[HORIZON_LAYERS] = { 2, 4, 8, 16, 32, 64, 128 };
+
+// Terrain heights at the mesh vertices; the mesh is linear in between, so
+// per-cell and per-sector extremes taken from here are exact.
+float terrainGrid[TERRAIN_CELLS + 1][TERRAIN_CELLS + 1];
+float terrainCellMin[TERRAIN_CELLS][TERRAIN_CELLS];
+Bounds terrainSectorBounds[TERRAIN_SECTORS * TERRAIN_SECTORS];
+
+// verts: the terrain mesh vertices, (TERRAIN_CELLS + 1)^2 of them, x-major
+void initTerrain(const Vec3* verts) {
+    for (int i = 0; i <= TERRAIN_CELLS; i++)
+        for (int j = 0; j <= TERRAIN_CELLS; j++)
+            terrainGrid[i][j] = verts[i * (TERRAIN_CELLS + 1) + j].y;
+    for (int i = 0; i < TERRAIN_CELLS; i++)
+        for (int j = 0; j < TERRAIN_CELLS; j++)
+            terrainCellMin[i][j] = std::min(std::min(terrainGrid[i][j], terrainGrid[i + 1][j]),
+                std::min(terrainGrid[i][j + 1], terrainGrid[i + 1][j + 1]));
+
+    for (int sx = 0; sx < TERRAIN_SECTORS; sx++) {
+        for (int sz = 0; sz < TERRAIN_SECTORS; sz++) {
+            float lo = 1e30f, hi = -1e30f;
+            for (int i = sx * SECTOR_CELLS; i <= (sx + 1) * SECTOR_CELLS; i++)
+                for (int j = sz * SECTOR_CELLS; j <= (sz + 1) * SECTOR_CELLS; j++) {
+                    lo = std::min(lo, terrainGrid[i][j]);
+                    hi = std::max(hi, terrainGrid[i][j]);
+                }
+            Bounds& b = terrainSectorBounds[sz * TERRAIN_SECTORS + sx];
+            b.min = { -TERRAIN_HALF + sx * SECTOR_CELLS * TERRAIN_STEP, lo, -TERRAIN_HALF + sz * SECTOR_CELLS * TERRAIN_STEP };
+            b.max = { b.min.x + SECTOR_CELLS * TERRAIN_STEP, hi, b.min.z + SECTOR_CELLS * TERRAIN_STEP };
+        }
+    }
+}
+
+// World-space box around a local box
+Bounds transformBounds(const Mat4& m, const Vec3& lo, const Vec3& hi) {
+    float c[3] = { (lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f, (lo.z + hi.z) * 0.5f };
+    float e[3] = { (hi.x - lo.x) * 0.5f, (hi.y - lo.y) * 0.5f, (hi.z - lo.z) * 0.5f };
+    float wc[3], we[3];
+    for (int r = 0; r < 3; r++) {
+        wc[r] = m.m[12 + r];
+        we[r] = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            wc[r] += m.m[k * 4 + r] * c[k];
+            we[r] += fabsf(m.m[k * 4 + r]) * e[k];
         }
-        glEnd();
     }
+    Bounds b;
+    b.min = { wc[0] - we[0], wc[1] - we[1], wc[2] - we[2] };
+    b.max = { wc[0] + we[0], wc[1] + we[1], wc[2] + we[2] };
+    return b;
+}
 
-    glColor3f(1, 0.95f, 0.7f);
-    glPushMatrix();
-    glTranslatef(sunX, sunY, sunZ);
-    glutSolidSphere(6.0f, 16, 16);
-    glPopMatrix();
+// glutSolidCone stands on z = 0 and points along +z
+Bounds shapeBounds(const Mat4& world, const PartShape& s) {
+    float r = s.shape == SHAPE_CUBE ? s.size * 0.5f : s.size;
+    if (s.shape == SHAPE_CONE) return transformBounds(world, { -r, -r, 0 }, { r, r, s.height });
+    return transformBounds(world, { -r, -r, -r }, { r, r, r });
+}
 
-    glDisable(GL_TEXTURE_2D);
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
+// Only solid, axis-aligned boxes are exactly their bounds
+void occlusionAddOccluder(const Mat4& world, const PartShape& s) {
+    if (s.shape != SHAPE_CUBE || occlusion.occluderCount >= MAX_OCCLUDERS) return;
+    if (world.m[1] != 0 || world.m[2] != 0 || world.m[4] != 0 || world.m[6] != 0 || world.m[8] != 0 || world.m[9] != 0) return;
+    Bounds b = shapeBounds(world, s);
+    if (b.max.x - b.min.x < OCC_MIN_OCCLUDER || b.max.y - b.min.y < OCC_MIN_OCCLUDER || b.max.z - b.min.z < OCC_MIN_OCCLUDER) return;
+    occlusion.occluders[occlusion.occluderCount++] = b;
 }
 
-void drawFloor() {
-    const float step = 2.0f;
-    const float half = 100.0f;
+const float HORIZON_BIN_WIDTH = 6.28318531f / HORIZON_BINS;
 
-    glDisable(GL_LIGHTING);
-    glColor3f(0.2f, 0.5f, 0.2f);
+inline int horizonBin(int b) { return ((b % HORIZON_BINS) + HORIZON_BINS) % HORIZON_BINS; }
 
-    glBegin(GL_TRIANGLES);
-    for (float x = -half; x < half; x += step) {
-        for (float z = -half; z < half; z += step) {
-            float h00 = terrainHeight(x, z);
-            float h10 = terrainHeight(x + step, z);
-            float h01 = terrainHeight(x, z + step);
-            float h11 = terrainHeight(x + step, z + step);
+// Any ray whose azimuth is within rIn / d of a cell's center crosses the cell
+// at a distance in [d - rIn, d + rIn], through ground at least as high as the
+// cell's lowest corner; that slope is written to every bin wholly inside.
+void buildHorizon() {
+    for (int k = 0; k < HORIZON_LAYERS; k++)
+        for (int b = 0; b < HORIZON_BINS; b++) occlusion.horizon[k][b] = -1e30f;
 
-            glVertex3f(x, h00, z);
-            glVertex3f(x + step, h10, z);
-            glVertex3f(x, h01, z + step);
+    const Vec3 eye = occlusion.eye;
+    const float rIn = TERRAIN_STEP * 0.5f;
+    // Farther out a cell is narrower than a bin
+    const float reach = std::min(rIn / sinf(HORIZON_BIN_WIDTH * 0.5f), horizonLayerRadius[HORIZON_LAYERS - 1] - rIn);
+    int i0 = std::max(0, (int)((eye.x - reach + TERRAIN_HALF) / TERRAIN_STEP));
+    int i1 = std::min(TERRAIN_CELLS - 1, (int)((eye.x + reach + TERRAIN_HALF) / TERRAIN_STEP));
+    int j0 = std::max(0, (int)((eye.z - reach + TERRAIN_HALF) / TERRAIN_STEP));
+    int j1 = std::min(TERRAIN_CELLS - 1, (int)((eye.z + reach + TERRAIN_HALF) / TERRAIN_STEP));
 
-            glVertex3f(x + step, h10, z);
-            glVertex3f(x + step, h11, z + step);
-            glVertex3f(x, h01, z + step);
+    for (int i = i0; i <= i1; i++) {
+        float dx = -TERRAIN_HALF + (i + 0.5f) * TERRAIN_STEP - eye.x;
+        for (int j = j0; j <= j1; j++) {
+            float dz = -TERRAIN_HALF + (j + 0.5f) * TERRAIN_STEP - eye.z;
+            float d2 = dx * dx + dz * dz;
+            if (d2 > reach * reach || d2 < 4.0f * rIn * rIn) continue;
+            float d = sqrtf(d2);
+            int layer = 0;
+            while (horizonLayerRadius[layer] < d + rIn) layer++;
+
+            float rise = terrainCellMin[i][j] - eye.y;
+            float slope = rise / (rise >= 0.0f ? d + rIn : d - rIn);
+            float az = atan2f(dz, dx), half = rIn / d;   // asin(x) >= x keeps this inside
+            int b0 = (int)ceilf((az - half) / HORIZON_BIN_WIDTH);
+            int b1 = (int)floorf((az + half) / HORIZON_BIN_WIDTH) - 1;
+            float* row = occlusion.horizon[layer];
+            for (int b = b0; b <= b1; b++) {
+                int idx = horizonBin(b);
+                if (slope > row[idx]) row[idx] = slope;
+            }
         }
     }
-    glEnd();
-    glEnable(GL_LIGHTING);
+    for (int k = 1; k < HORIZON_LAYERS; k++)
+        for (int b = 0; b < HORIZON_BINS; b++)
+            occlusion.horizon[k][b] = std::max(occlusion.horizon[k][b], occlusion.horizon[k - 1][b]);
 }
 
-void drawEnvironment() {
-    for (int i = 0; i < 30; ++i) {
-        drawRock(rocks[i].pos, rocks[i].scale);
+bool horizonHides(const Bounds& box) {
+    const Vec3 eye = occlusion.eye;
+    float nx = std::min(std::max(eye.x, box.min.x), box.max.x) - eye.x;
+    float nz = std::min(std::max(eye.z, box.min.z), box.max.z) - eye.z;
+    float dNear = sqrtf(nx * nx + nz * nz);
+    if (dNear < horizonLayerRadius[0]) return false;
+    int layer = HORIZON_LAYERS - 1;
+    while (horizonLayerRadius[layer] > dNear) layer--;
+
+    // Azimuth span of the footprint; the eye is outside it, so under half a turn
+    float cx = (box.min.x + box.max.x) * 0.5f - eye.x, cz = (box.min.z + box.max.z) * 0.5f - eye.z;
+    float center = atan2f(cz, cx), lo = 0.0f, hi = 0.0f, dFar2 = 0.0f;
+    for (int c = 0; c < 4; c++) {
+        float x = (c & 1 ? box.max.x : box.min.x) - eye.x;
+        float z = (c & 2 ? box.max.z : box.min.z) - eye.z;
+        float delta = atan2f(z, x) - center;
+        if (delta > 3.14159265f) delta -= 6.28318531f;
+        if (delta < -3.14159265f) delta += 6.28318531f;
+        lo = std::min(lo, delta);
+        hi = std::max(hi, delta);
+        dFar2 = std::max(dFar2, x * x + z * z);
+    }
+    float rise = box.max.y - eye.y;
+    float slope = rise / (rise >= 0.0f ? dNear : sqrtf(dFar2));
+
+    int b0 = (int)floorf((center + lo) / HORIZON_BIN_WIDTH);
+    int b1 = (int)floorf((center + hi) / HORIZON_BIN_WIDTH);
+    const float* row = occlusion.horizon[layer];
+    for (int b = b0; b <= b1; b++)
+        if (row[horizonBin(b)] <= slope) return false;
+    return true;
+}
+
+// Only pixels the triangle covers completely are written, each with the
+// farthest depth the triangle reaches inside it.
+void rasterOccluderTriangle(const Vec4& a, const Vec4& b, const Vec4& c) {
+    float ax = (a.x / a.w * 0.5f + 0.5f) * OCC_W, ay = (a.y / a.w * 0.5f + 0.5f) * OCC_H, az = a.z / a.w;
+    float bx = (b.x / b.w * 0.5f + 0.5f) * OCC_W, by = (b.y / b.w * 0.5f + 0.5f) * OCC_H, bz = b.z / b.w;
+    float cx = (c.x / c.w * 0.5f + 0.5f) * OCC_W, cy = (c.y / c.w * 0.5f + 0.5f) * OCC_H, cz = c.z / c.w;
+    float area = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+    if (fabsf(area) < 1e-6f) return;
+    if (area < 0.0f) {
+        std::swap(bx, cx); std::swap(by, cy); std::swap(bz, cz);
+        area = -area;
     }
 
-    // Trees
-    glColor3f(0.4f, 0.25f, 0.1f);
-    glPushMatrix(); glTranslatef(-8.0f, terrainHeight(-8, 12) + 1.0f, 12.0f); glRotatef(-90, 1, 0, 0); glutSolidCone(0.4f, 3.0f, 8, 8); glPopMatrix();
-    glColor3f(0.1f, 0.5f, 0.1f);
-    glPushMatrix(); glTranslatef(-8.0f, terrainHeight(-8, 12) + 3.0f, 12.0f); glutSolidCone(1.8f, 3.5f, 8, 8); glPopMatrix();
+    int x0 = std::max(0, (int)floorf(std::min(ax, std::min(bx, cx))));
+    int x1 = std::min(OCC_W - 1, (int)floorf(std::max(ax, std::max(bx, cx))));
+    int y0 = std::max(0, (int)floorf(std::min(ay, std::min(by, cy))));
+    int y1 = std::min(OCC_H - 1, (int)floorf(std::max(ay, std::max(by, cy))));
+    if (x0 > x1 || y0 > y1) return;
+
+    // Edge functions, positive inside; the slack moves the test to the worst corner
+    const float px[3] = { ax, bx, cx }, py[3] = { ay, by, cy };
+    float ea[3], eb[3], ec[3], slack[3];
+    for (int k = 0; k < 3; k++) {
+        int n = (k + 1) % 3;
+        ea[k] = py[k] - py[n];
+        eb[k] = px[n] - px[k];
+        ec[k] = -(ea[k] * px[k] + eb[k] * py[k]);
+        slack[k] = 0.5f * (fabsf(ea[k]) + fabsf(eb[k]));
+    }
+    float dzdx = ((bz - az) * (cy - ay) - (cz - az) * (by - ay)) / area;
+    float dzdy = ((cz - az) * (bx - ax) - (bz - az) * (cx - ax)) / area;
+    float zSlack = 0.5f * (fabsf(dzdx) + fabsf(dzdy));
+
+    for (int y = y0; y <= y1; y++) {
+        float fy = y + 0.5f;
+        for (int x = x0; x <= x1; x++) {
+            float fx = x + 0.5f;
+            if (ea[0] * fx + eb[0] * fy + ec[0] < slack[0] ||
+                ea[1] * fx + eb[1] * fy + ec[1] < slack[1] ||
+                ea[2] * fx + eb[2] * fy + ec[2] < slack[2]) continue;
+            float z = az + dzdx * (fx - ax) + dzdy * (fy - ay) + zSlack;
+            if (z < occlusion.depth[y][x]) occlusion.depth[y][x] = z;
+        }
+    }
+}
+
+// Convex polygon in clip space, clipped against the near plane
+void rasterOccluder(const Vec4* v, int n) {
+    Vec4 out[8];
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        const Vec4& p = v[i];
+        const Vec4& q = v[(i + 1) % n];
+        float dp = p.z + p.w, dq = q.z + q.w;
+        if (dp >= 0.0f) out[m++] = p;
+        if ((dp >= 0.0f) != (dq >= 0.0f)) {
+            float t = dp / (dp - dq);
+            out[m++] = Vec4(p.x + (q.x - p.x) * t, p.y + (q.y - p.y) * t, p.z + (q.z - p.z) * t, p.w + (q.w - p.w) * t);
+        }
+    }
+    for (int i = 1; i + 1 < m; i++) rasterOccluderTriangle(out[0], out[i], out[i + 1]);
+}
+
+void rasterOccluderBox(const Bounds& b) {
+    Vec4 c[8];
+    for (int i = 0; i < 8; i++)
+        c[i] = mat4TransformVec4(occlusion.viewProj, Vec4(i & 1 ? b.max.x : b.min.x, i & 2 ? b.max.y : b.min.y, i & 4 ? b.max.z : b.min.z, 1));
+    static const int faces[6][4] = { {0,2,3,1}, {4,5,7,6}, {0,1,5,4}, {2,6,7,3}, {0,4,6,2}, {1,3,7,5} };
+    for (int f = 0; f < 6; f++) {
+        Vec4 quad[4] = { c[faces[f][0]], c[faces[f][1]], c[faces[f][2]], c[faces[f][3]] };
+        rasterOccluder(quad, 4);
+    }
+}
+
+// The terrain cells around the eye, split the same way as the mesh
+void rasterOccluderTerrain() {
+    const int R = (int)(OCC_TERRAIN_RADIUS / TERRAIN_STEP) + 1;
+    static Vec4 clip[2 * R + 2][2 * R + 2];
+    const Vec3 eye = occlusion.eye;
+    int ci = (int)floorf((eye.x + TERRAIN_HALF) / TERRAIN_STEP), cj = (int)floorf((eye.z + TERRAIN_HALF) / TERRAIN_STEP);
+    int i0 = std::max(0, ci - R), i1 = std::min(TERRAIN_CELLS, ci + R + 1);
+    int j0 = std::max(0, cj - R), j1 = std::min(TERRAIN_CELLS, cj + R + 1);
+    if (i0 >= i1 || j0 >= j1) return;
+
+    for (int i = i0; i <= i1; i++)
+        for (int j = j0; j <= j1; j++)
+            clip[i - i0][j - j0] = mat4TransformVec4(occlusion.viewProj,
+                Vec4(-TERRAIN_HALF + i * TERRAIN_STEP, terrainGrid[i][j], -TERRAIN_HALF + j * TERRAIN_STEP, 1));
+
+    const float r2 = OCC_TERRAIN_RADIUS * OCC_TERRAIN_RADIUS;
+    for (int i = i0; i < i1; i++) {
+        float dx = -TERRAIN_HALF + (i + 0.5f) * TERRAIN_STEP - eye.x;
+        for (int j = j0; j < j1; j++) {
+            float dz = -TERRAIN_HALF + (j + 0.5f) * TERRAIN_STEP - eye.z;
+            if (dx * dx + dz * dz > r2) continue;
+            const Vec4& v00 = clip[i - i0][j - j0];
+            const Vec4& v10 = clip[i + 1 - i0][j - j0];
+            const Vec4& v01 = clip[i - i0][j + 1 - j0];
+            const Vec4& v11 = clip[i + 1 - i0][j + 1 - j0];
+            Vec4 t0[3] = { v00, v10, v01 }, t1[3] = { v10, v11, v01 };
+            rasterOccluder(t0, 3);
+            rasterOccluder(t1, 3);
+        }
+    }
+}
+
+// Call after the view and projection matrices are final for the frame.
+void occlusionBegin(const Vec3& eye, const Mat4& view, const Mat4& proj) {
+    occlusion.frame = OcclusionStats();
+    if (!occlusion.enabled) return;
+    double start = preciseSeconds();
+    occlusion.eye = eye;
+    occlusion.viewProj = mat4Mul(proj, view);
+    buildHorizon();
+    for (int y = 0; y < OCC_H; y++)
+        for (int x = 0; x < OCC_W; x++) occlusion.depth[y][x] = 1.0f;
+    for (int i = 0; i < occlusion.occluderCount; i++) rasterOccluderBox(occlusion.occluders[i]);
+    rasterOccluderTerrain();
+    occlusion.frame.buildMs = (preciseSeconds() - start) * 1000.0;
+}
+
+int depthTest(const Bounds& b) {
+    float x0 = 1e30f, x1 = -1e30f, y0 = 1e30f, y1 = -1e30f, zNear = 1e30f;
+    for (int i = 0; i < 8; i++) {
+        Vec4 p = mat4TransformVec4(occlusion.viewProj, Vec4(i & 1 ? b.max.x : b.min.x, i & 2 ? b.max.y : b.min.y, i & 4 ? b.max.z : b.min.z, 1));
+        if (p.z + p.w < 0.0f) return OCC_VISIBLE;   // reaches past the near plane
+        float iw = 1.0f / p.w;
+        x0 = std::min(x0, p.x * iw); x1 = std::max(x1, p.x * iw);
+        y0 = std::min(y0, p.y * iw); y1 = std::max(y1, p.y * iw);
+        zNear = std::min(zNear, p.z * iw);
+    }
+    if (x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f || zNear > 1.0f) return OCC_OUTSIDE;
+
+    int px0 = std::max(0, (int)floorf((x0 * 0.5f + 0.5f) * OCC_W));
+    int px1 = std::min(OCC_W - 1, (int)floorf((x1 * 0.5f + 0.5f) * OCC_W));
+    int py0 = std::max(0, (int)floorf((y0 * 0.5f + 0.5f) * OCC_H));
+    int py1 = std::min(OCC_H - 1, (int)floorf((y1 * 0.5f + 0.5f) * OCC_H));
+    for (int y = py0; y <= py1; y++)
+        for (int x = px0; x <= px1; x++)
+            if (occlusion.depth[y][x] >= zNear) return OCC_VISIBLE;
+    return OCC_DEPTH;
+}
+
+bool occlusionVisible(const Bounds& b, int kind) {
+    if (!occlusion.enabled) return true;
+    OcclusionStats& s = occlusion.frame;
+    s.tested[kind]++;
+    int result = horizonHides(b) ? OCC_HORIZON : depthTest(b);
+    if (result == OCC_VISIBLE) return true;
+    s.hidden[kind]++;
+    if (result == OCC_HORIZON) s.byHorizon++;
+    else if (result == OCC_DEPTH) s.byDepth++;
+    else s.outsideView++;
+    return false;
+}
+// --------------------------------------------------------------
+
+// ---------------------- JOB POOL -------------------------
+// A few persistent worker threads; parallelFor() hands out job indices and
+// the calling thread works along until all of them are done.
+#define MAX_WORKERS 7
+
+typedef void (*JobFn)(int index, void* ctx);
+
+struct JobPool {
+    int workerCount = 0;
+    std::mutex mutex;
+    std::condition_variable wake, idle;
+    JobFn fn = 0;
+    void* ctx = 0;
+    int jobCount = 0;
+    int generation = 0;
+    int active = 0;            // workers inside a batch
+    std::atomic<int> next{ 0 }, done{ 0 };
+};
+// Never destroyed: the detached workers are still waiting on its condition
+// variables when exit() runs the static destructors.
+JobPool& jobPool = *new JobPool;
+
+void runJobs(JobFn fn, void* ctx, int count) {
+    for (int i = jobPool.next.fetch_add(1); i < count; i = jobPool.next.fetch_add(1)) {
+        fn(i, ctx);
+        jobPool.done.fetch_add(1);
+    }
+}
+
+void jobWorker() {
+    int seen = 0;
+    for (;;) {
+        std::unique_lock<std::mutex> lock(jobPool.mutex);
+        jobPool.wake.wait(lock, [&] { return jobPool.generation != seen; });
+        seen = jobPool.generation;
+        JobFn fn = jobPool.fn; void* ctx = jobPool.ctx; int count = jobPool.jobCount;
+        jobPool.active++;
+        lock.unlock();
+        runJobs(fn, ctx, count);
+        lock.lock();
+        if (--jobPool.active == 0) jobPool.idle.notify_one();
+    }
+}
+
+void initJobPool(int workers) {
+    if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+    for (int i = 0; i < workers; i++) std::thread(jobWorker).detach();
+    jobPool.workerCount = workers > 0 ? workers : 0;
+}
+
+void parallelFor(int count, JobFn fn, void* ctx) {
+    if (count <= 0) return;
+    if (jobPool.workerCount == 0 || count == 1) {
+        for (int i = 0; i < count; i++) fn(i, ctx);
+        return;
+    }
+    {
+        // Stragglers from the previous batch must be out before the counters reset
+        std::unique_lock<std::mutex> lock(jobPool.mutex);
+        jobPool.idle.wait(lock, [] { return jobPool.active == 0; });
+        jobPool.fn = fn; jobPool.ctx = ctx; jobPool.jobCount = count;
+        jobPool.done = 0; jobPool.next = 0;
+        jobPool.generation++;
+    }
+    jobPool.wake.notify_all();
+    runJobs(fn, ctx, count);
+    while (jobPool.done.load() < count) std::this_thread::yield();
+}
+// --------------------------------------------------------------
+
+// ---------------------- METRICS -------------------------
+// Process telemetry for long unattended sessions. Recording never locks:
+//  - counters are sharded per thread, each shard on its own cache line, and
+//    only summed when exported;
+//  - gauges are single atomics, last value wins;
+//  - histograms are log-linear (HDR style): 8 sub-buckets per power of two,
+//    so any recorded value is known to within 12.5%.
+// A background thread renders everything in the Prometheus text format,
+// periodically to --metrics-file and on request to a localhost
+// --metrics-port.
+#define METRIC_SHARDS 16
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+#define METRICS_TEXT_BYTES (64 * 1024)
+#define METRICS_CLIENT_TIMEOUT 1     // seconds a scrape client gets to send and read
+
+enum CounterId { CTR_SHOTS, CTR_HITS, CTR_BULLETS_EXHAUSTED, CTR_PARTICLES_EXHAUSTED, CTR_RESPAWNS, COUNTER_COUNT };
+enum GaugeId { GAUGE_BULLETS, GAUGE_PARTICLES, GAUGE_ENEMIES, GAUGE_RSS, GAUGE_COUNT };
+enum HistogramId { HIST_FRAME, HIST_TICK, HIST_COLLISION_PAIRS, HISTOGRAM_COUNT };
+
+// Consecutive entries with the same name are one metric family
+struct MetricInfo {
+    const char* name;
+    const char* labels;
+    const char* help;
+};
+
+const MetricInfo counterInfo[COUNTER_COUNT] = {
+    { "fps_shots_total", "", "Bullets fired by the player." },
+    { "fps_hits_total", "", "Player bullets that hit an enemy." },
+    { "fps_pool_exhausted_total", "pool=\"bullets\"", "Spawns dropped because the pool was full." },
+    { "fps_pool_exhausted_total", "pool=\"particles\"", "" },
+    { "fps_enemy_respawns_total", "", "Enemies brought back after dying." },
+};
+const MetricInfo gaugeInfo[GAUGE_COUNT] = {
+    { "fps_live_entities", "kind=\"bullets\"", "Entities alive at the last frame." },
+    { "fps_live_entities", "kind=\"particles\"", "" },
+    { "fps_live_entities", "kind=\"enemies\"", "" },
+    { "fps_resident_memory_bytes", "", "Resident set size of the process." },
+};
+// Histograms take integers; scale converts to the exported unit
+const MetricInfo histogramInfo[HISTOGRAM_COUNT] = {
+    { "fps_frame_seconds", "", "Frame work, the larger of CPU time in display() and GPU time." },
+    { "fps_tick_seconds", "", "Simulation tick, all systems." },
+    { "fps_collision_pairs", "", "Bullet and enemy pairs tested per tick." },
+};
+const double histogramScale[HISTOGRAM_COUNT] = { 1e-6, 1e-6, 1.0 };
+
+struct alignas(64) CounterShard {
+    std::atomic<uint64_t> value[COUNTER_COUNT];
+};
+
+struct Histogram {
+    std::atomic<uint64_t> bucket[HIST_BUCKETS];
+    std::atomic<uint64_t> sum;    // the count is the buckets' total
+};
+
+struct Metrics {
+    CounterShard shards[METRIC_SHARDS];
+    std::atomic<int> nextShard{ 0 };
+    std::atomic<int64_t> gauges[GAUGE_COUNT];
+    Histogram histograms[HISTOGRAM_COUNT];
+
+    // Export
+    char file[256] = "";
+    int port = 0;
+    float interval = 10.0f;   // seconds between file writes
+    int exports = 0;
+};
+// Never destroyed, the exporter thread may still be using it at exit
+Metrics& metrics = *new Metrics();
+
+inline int metricsShard() {
+    static thread_local int shard = metrics.nextShard.fetch_add(1) % METRIC_SHARDS;
+    return shard;
+}
+
+inline void metricsCount(int counter, uint64_t n = 1) {
+    metrics.shards[metricsShard()].value[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+inline void metricsSet(int gauge, int64_t value) {
+    metrics.gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+// Values below 2^(HIST_SUB_BITS+1) are exact; above, the top HIST_SUB_BITS
+// bits under the leading one pick the sub-bucket.
+inline int histogramBucket(uint64_t v) {
+    if (v < (2u << HIST_SUB_BITS)) return (int)v;
+    int e = 63;
+    while (!(v >> e)) e--;
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + (int)((v >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+// Exclusive upper bound of a bucket
+inline double histogramBucketLimit(int b) {
+    if (b < (2 << HIST_SUB_BITS)) return b + 1.0;
+    int e = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1, m = b & ((1 << HIST_SUB_BITS) - 1);
+    return ldexp((double)((1 << HIST_SUB_BITS) + m + 1), e - HIST_SUB_BITS);
+}
+
+inline void metricsRecord(int histogram, uint64_t value) {
+    Histogram& h = metrics.histograms[histogram];
+    h.bucket[histogramBucket(value)].fetch_add(1, std::memory_order_relaxed);
+    h.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+int64_t residentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? (int64_t)pmc.WorkingSetSize : 0;
+#else
+    long pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+// Prometheus text exposition format, version 0.0.4
+int metricsRender(char* out, int capacity) {
+    int n = 0;
+    auto put = [&](const char* fmt, auto... args) {
+        if (n < capacity) n += snprintf(out + n, capacity - n, fmt, args...);
+    };
+    auto header = [&](const MetricInfo* info, int i, const char* type) {
+        if (i > 0 && !strcmp(info[i - 1].name, info[i].name)) return;
+        put("# HELP %s %s\n# TYPE %s %s\n", info[i].name, info[i].help, info[i].name, type);
+    };
+
+    metricsSet(GAUGE_RSS, residentBytes());
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        uint64_t total = 0;
+        for (int s = 0; s < METRIC_SHARDS; s++) total += metrics.shards[s].value[c].load(std::memory_order_relaxed);
+        header(counterInfo, c, "counter");
+        put(*counterInfo[c].labels ? "%s{%s} %llu\n" : "%s%s %llu\n", counterInfo[c].name, counterInfo[c].labels, (unsigned long long)total);
+    }
+    for (int g = 0; g < GAUGE_COUNT; g++) {
+        header(gaugeInfo, g, "gauge");
+        put(*gaugeInfo[g].labels ? "%s{%s} %lld\n" : "%s%s %lld\n", gaugeInfo[g].name, gaugeInfo[g].labels,
+            (long long)metrics.gauges[g].load(std::memory_order_relaxed));
+    }
+    for (int i = 0; i < HISTOGRAM_COUNT; i++) {
+        const Histogram& h = metrics.histograms[i];
+        const char* name = histogramInfo[i].name;
+        header(histogramInfo, i, "histogram");
+        // Buckets up to the highest one ever used, so the set only grows
+        int last = HIST_BUCKETS - 1;
+        while (last > 0 && h.bucket[last].load(std::memory_order_relaxed) == 0) last--;
+        uint64_t cumulative = 0;
+        for (int b = 0; b <= last; b++) {
+            cumulative += h.bucket[b].load(std::memory_order_relaxed);
+            // Recorded values are integers, so the largest one in the bucket is its limit minus one
+            put("%s_bucket{le=\"%.9g\"} %llu\n", name, (histogramBucketLimit(b) - 1.0) * histogramScale[i], (unsigned long long)cumulative);
+        }
+        put("%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+        put("%s_sum %.9g\n%s_count %llu\n", name, h.sum.load(std::memory_order_relaxed) * histogramScale[i], name, (unsigned long long)cumulative);
+    }
+    return n < capacity ? n : capacity - 1;
+}
+
+// Same temporary name and rename as assetStore(), so readers never see half a file
+void metricsWriteFile(const char* text, int length) {
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics.file);
+    FILE* f = fopen(tmp, "wb");
+    if (!f) return;
+    bool ok = fwrite(text, 1, length, f) == (size_t)length;
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp, metrics.file, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp, metrics.file) == 0;
+#endif
+    if (!ok) remove(tmp);
+}
+
+#ifdef _WIN32
+typedef SOCKET MetricsSocket;
+#define closeSocket closesocket
+#else
+typedef int MetricsSocket;
+#define INVALID_SOCKET (-1)
+#define closeSocket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+MetricsSocket metricsListen(int port) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) return INVALID_SOCKET;
+#endif
+    MetricsSocket s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == INVALID_SOCKET) return s;
+    int yes = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+    if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(s, 4) != 0) {
+        closeSocket(s);
+        return INVALID_SOCKET;
+    }
+    return s;
+}
+
+// Any request gets the current metrics; this is a scrape endpoint, not a web server.
+// A client that sends nothing or stops reading is dropped after METRICS_CLIENT_TIMEOUT
+// so it cannot stall the periodic file export.
+bool metricsServe(MetricsSocket client, char* text) {
+#ifdef _WIN32
+    DWORD sendTimeout = METRICS_CLIENT_TIMEOUT * 1000;
+#else
+    timeval sendTimeout = { METRICS_CLIENT_TIMEOUT, 0 };
+#endif
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&sendTimeout, sizeof(sendTimeout));
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(client, &ready);
+    timeval tv = { METRICS_CLIENT_TIMEOUT, 0 };
+    char request[1024];
+    if (select((int)client + 1, &ready, 0, 0, &tv) <= 0 || recv(client, request, sizeof(request), 0) <= 0) {
+        closeSocket(client);
+        return false;
+    }
+    int length = metricsRender(text, METRICS_TEXT_BYTES);
+    char header[160];
+    int headerLength = snprintf(header, sizeof(header),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", length);
+    send(client, header, headerLength, MSG_NOSIGNAL);
+    send(client, text, length, MSG_NOSIGNAL);
+    closeSocket(client);
+    return true;
+}
+
+void metricsExporter(MetricsSocket server) {
+    static char text[METRICS_TEXT_BYTES];
+    double nextWrite = preciseSeconds();
+    for (;;) {
+        if (metrics.file[0] && preciseSeconds() >= nextWrite) {
+            metricsWriteFile(text, metricsRender(text, METRICS_TEXT_BYTES));
+            metrics.exports++;
+            nextWrite += metrics.interval;
+        }
+        double wait = metrics.file[0] ? nextWrite - preciseSeconds() : 1.0;
+        if (wait < 0.0) wait = 0.0;
+        if (server == INVALID_SOCKET) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+            continue;
+        }
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(server, &ready);
+        timeval tv = { (long)wait, (long)((wait - (long)wait) * 1e6) };
+        if (select((int)server + 1, &ready, 0, 0, &tv) > 0) {
+            MetricsSocket client = accept(server, 0, 0);
+            if (client != INVALID_SOCKET && metricsServe(client, text)) metrics.exports++;
+        }
+    }
+}
+
+// Call after the command line is parsed; does nothing unless an output was asked for
+void startMetrics() {
+    if (!metrics.file[0] && metrics.port <= 0) return;
+    if (metrics.interval < 0.1f) metrics.interval = 0.1f;
+    MetricsSocket server = INVALID_SOCKET;
+    if (metrics.port > 0) {
+        server = metricsListen(metrics.port);
+        if (server == INVALID_SOCKET) printf("Metrics: cannot listen on 127.0.0.1:%d\n", metrics.port);
+        else printf("Metrics: http://127.0.0.1:%d/metrics\n", metrics.port);
+    }
+    if (metrics.file[0]) printf("Metrics: writing %s every %.1f s\n", metrics.file, metrics.interval);
+    if (server != INVALID_SOCKET || metrics.file[0]) std::thread(metricsExporter, server).detach();
+}
+// --------------------------------------------------------------
+
+// ---------------------- ASSET CACHE -------------------------
+// Procedural startup data (sky texture, meshes, baked lighting) is stored
+// content-addressed: an asset's key is a hash of everything its generator
+// reads, and it lives in <cache dir>/<key>.asset. A file is never rewritten,
+// so a hit is simply mapped read-only and used in place, and a stale entry
+// just stops being asked for. New files go through a temporary name and a
+// rename, so a crash never leaves a half-written asset behind.
+#define ASSET_MAGIC "FPSASSET"
+
+struct AssetFileHeader {
+    char magic[8];
+    uint64_t key;
+    uint64_t size;
+    uint64_t payloadHash;    // hashPayload(), checked on every load
+};
+
+struct AssetCache {
+    char dir[256] = "bake-cache";
+    bool enabled = true;
+    int hits = 0, misses = 0;
+    size_t mappedBytes = 0;
+};
+AssetCache assetCache;
+
+uint64_t hashBytes(uint64_t h, const void* data, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; i++) { h ^= p[i]; h *= 1099511628211ull; }
+    return h;
+}
+const uint64_t HASH_SEED = 14695981039346656037ull;
+
+// Integrity check of a cached payload, 8 bytes a step so a warm start stays cheap
+uint64_t hashPayload(const void* data, size_t bytes) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t h = HASH_SEED ^ bytes;
+    size_t words = bytes / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, p + i * 8, 8);
+        h = (h ^ w) * 1099511628211ull;
+        h ^= h >> 29;
+    }
+    return hashBytes(h, p + words * 8, bytes - words * 8);
+}
+
+void assetPath(char* path, size_t size, uint64_t key, const char* ext) {
+    snprintf(path, size, "%s/%016llx.%s", assetCache.dir, (unsigned long long)key, ext);
+}
+
+// Maps the whole file read-only; a mapping that is used stays for the life of the process
+const unsigned char* mapFile(const char* path, size_t* size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER length;
+    HANDLE mapping = 0;
+    const unsigned char* data = 0;
+    if (GetFileSizeEx(file, &length) && length.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping) data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (mapping) CloseHandle(mapping);
+    CloseHandle(file);
+    *size = data ? (size_t)length.QuadPart : 0;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return 0;
+    *size = (size_t)st.st_size;
+    return (const unsigned char*)data;
+#endif
+}
+
+void unmapFile(const unsigned char* data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap((void*)data, size);
+#endif
+}
+
+// The cached payload for a key, or null if there is none of the expected size
+// or its contents do not match the hash stored with it. A bad file is simply
+// regenerated and replaced.
+const void* assetLoad(uint64_t key, size_t size) {
+    if (!assetCache.enabled) return 0;
+    char path[300];
+    assetPath(path, sizeof(path), key, "asset");
+    size_t fileSize = 0;
+    const unsigned char* file = mapFile(path, &fileSize);
+    if (!file) { assetCache.misses++; return 0; }
+    const AssetFileHeader* h = (const AssetFileHeader*)file;
+    if (fileSize != sizeof(AssetFileHeader) + size || memcmp(h->magic, ASSET_MAGIC, 8) || h->key != key || h->size != size ||
+        hashPayload(file + sizeof(AssetFileHeader), size) != h->payloadHash) {
+        unmapFile(file, fileSize);   // also lets assetStore() replace it on Windows
+        assetCache.misses++;
+        return 0;
+    }
+    assetCache.hits++;
+    assetCache.mappedBytes += fileSize;
+    return file + sizeof(AssetFileHeader);
+}
+
+void assetStore(uint64_t key, const void* data, size_t size) {
+    if (!assetCache.enabled) return;
+#ifdef _WIN32
+    _mkdir(assetCache.dir);
+#else
+    mkdir(assetCache.dir, 0755);
+#endif
+    char tmp[300], path[300];
+    assetPath(tmp, sizeof(tmp), key, "tmp");
+    assetPath(path, sizeof(path), key, "asset");
+    FILE* f = fopen(tmp, "wb");
+    if (!f) return;
+    AssetFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ASSET_MAGIC, 8);
+    h.key = key;
+    h.size = size;
+    h.payloadHash = hashPayload(data, size);
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(data, 1, size, f) == size;
+    ok = fclose(f) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp, path) == 0;
+#endif
+    if (!ok) remove(tmp);
+}
+// --------------------------------------------------------------
+
+// ---------------------- BAKED LIGHTING -------------------------
+// The sun never moves, so everything static is lit once at startup: sun
+// diffuse with heightfield shadows plus ambient occlusion go into per-vertex
+// colors and the terrain and props are drawn unlit from vertex arrays. The
+// bake runs on the job pool and goes into the asset cache under a hash of
+// everything it depends on (terrain heights, box occluders, sun, bake
+// settings, the props), so later runs with the same inputs just map the colors.
+// The terrain and the fixed props are one entry whose key does not change
+// between runs. Props placed from the layout seed are a second entry; a
+// clock-seeded layout never comes back, so it is baked every run and only a
+// --layout-seed layout is stored.
+#define BAKE_VERSION 2
+#define MESH_VERSION 1
+#define MAX_STATIC_MESHES 8
+#define MAX_STATIC_VERTS 8192
+#define MAX_BAKED_INSTANCES 256
+#define MAX_BAKED_COLORS 32768
+#define CUBE_DIVISIONS 4          // per face edge, so AO has vertices to land on
+#define SHADOW_STEP 1.0f
+#define SHADOW_DISTANCE 60.0f
+#define SHADOW_SOFTNESS 8.0f      // clearance slope below which the sun fades out
+#define AO_DIRECTIONS 8
+#define AO_DISTANCE 8.0f
+#define AO_RAYS 16                // props sample a hemisphere instead
+
+const Vec3 BAKE_AMBIENT = { 0.30f, 0.33f, 0.40f };   // sky light, bluish
+const Vec3 BAKE_SUN = { 0.90f, 0.85f, 0.75f };       // same as GL_LIGHT0 diffuse
+
+// Local-space triangle list for one prop shape, shared by every prop using it.
+// Vertex counts are known up front; the vertices themselves are an asset.
+struct StaticMesh { PartShape shape; int first, count; };
+
+struct MeshWriter { Vec3* pos; Vec3* normal; int count; };
+
+// One static prop: its mesh and the slice of baked colors it owns, in the
+// fixed or the layout colors
+struct BakedInstance { Mat4 world; int mesh, firstColor; Vec3 color; bool layout; };
+
+struct BakedLighting {
+    StaticMesh meshes[MAX_STATIC_MESHES];
+    int meshCount = 0;
+    int meshVertexCount = 0;
+    const Vec3* meshPos = 0;        // meshVertexCount positions, then as many normals
+    const Vec3* meshNormal = 0;
+
+    BakedInstance instances[MAX_BAKED_INSTANCES];
+    int instanceCount = 0;
+    int propColorCount = 0;
+    int layoutColorCount = 0;
+
+    // Asset data: terrain vertex colors, then fixed prop vertex colors; and
+    // the layout prop colors
+    const unsigned char (*terrainColors)[3] = 0;
+    const unsigned char (*propColors)[3] = 0;
+    const unsigned char (*layoutColors)[3] = 0;
+
+    Vec3 sunDir;
+    uint64_t key = 0, layoutKey = 0;
+    bool fromCache = false, layoutFromCache = false;
+    bool storeLayout = false;       // --layout-seed, so the layout can come back
+    double ms = 0.0;
+};
+BakedLighting baked;
+
+void meshVertex(MeshWriter& w, const Vec3& p, const Vec3& n) {
+    w.pos[w.count] = p;
+    w.normal[w.count] = n;
+    w.count++;
+}
+
+void meshQuad(MeshWriter& w, const Vec3& a, const Vec3& b, const Vec3& c, const Vec3& d, const Vec3& na, const Vec3& nb, const Vec3& nc, const Vec3& nd) {
+    meshVertex(w, a, na); meshVertex(w, b, nb); meshVertex(w, c, nc);
+    meshVertex(w, a, na); meshVertex(w, c, nc); meshVertex(w, d, nd);
+}
+
+// Same shapes and tessellation as the glutSolid* calls they replace
+void buildSphere(MeshWriter& w, float r, int slices, int stacks) {
+    for (int st = 0; st < stacks; st++) {
+        float p0 = 3.14159265f * st / stacks - 1.5707963f, p1 = 3.14159265f * (st + 1) / stacks - 1.5707963f;
+        for (int sl = 0; sl < slices; sl++) {
+            float a0 = 6.28318531f * sl / slices, a1 = 6.28318531f * (sl + 1) / slices;
+            Vec3 n[4] = {
+                { cosf(p0) * cosf(a0), cosf(p0) * sinf(a0), sinf(p0) }, { cosf(p0) * cosf(a1), cosf(p0) * sinf(a1), sinf(p0) },
+                { cosf(p1) * cosf(a1), cosf(p1) * sinf(a1), sinf(p1) }, { cosf(p1) * cosf(a0), cosf(p1) * sinf(a0), sinf(p1) } };
+            meshQuad(w, vecScale(n[0], r), vecScale(n[1], r), vecScale(n[2], r), vecScale(n[3], r), n[0], n[1], n[2], n[3]);
+        }
+    }
+}
+
+void buildCone(MeshWriter& w, float r, float h, int slices, int stacks) {
+    float slant = sqrtf(r * r + h * h);
+    for (int sl = 0; sl < slices; sl++) {
+        float a0 = 6.28318531f * sl / slices, a1 = 6.28318531f * (sl + 1) / slices;
+        Vec3 n0 = { cosf(a0) * h / slant, sinf(a0) * h / slant, r / slant };
+        Vec3 n1 = { cosf(a1) * h / slant, sinf(a1) * h / slant, r / slant };
+        for (int st = 0; st < stacks; st++) {
+            float t0 = st / (float)stacks, t1 = (st + 1) / (float)stacks;
+            float r0 = r * (1 - t0), r1 = r * (1 - t1);
+            meshQuad(w, { cosf(a0) * r0, sinf(a0) * r0, h * t0 }, { cosf(a1) * r0, sinf(a1) * r0, h * t0 },
+                { cosf(a1) * r1, sinf(a1) * r1, h * t1 }, { cosf(a0) * r1, sinf(a0) * r1, h * t1 }, n0, n1, n1, n0);
+        }
+        Vec3 down = { 0, 0, -1 };
+        meshVertex(w, { 0, 0, 0 }, down);
+        meshVertex(w, { cosf(a1) * r, sinf(a1) * r, 0 }, down);
+        meshVertex(w, { cosf(a0) * r, sinf(a0) * r, 0 }, down);
+    }
+}
+
+void buildCube(MeshWriter& w, float size) {
+    float h = size * 0.5f;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = -1; side <= 1; side += 2) {
+            // u, v span the face; their order keeps the winding counter-clockwise from outside
+            int u = (axis + (side > 0 ? 1 : 2)) % 3, v = (axis + (side > 0 ? 2 : 1)) % 3;
+            float n[3] = { 0, 0, 0 };
+            n[axis] = (float)side;
+            Vec3 normal = { n[0], n[1], n[2] };
+            for (int i = 0; i < CUBE_DIVISIONS; i++) {
+                for (int j = 0; j < CUBE_DIVISIONS; j++) {
+                    Vec3 q[4];
+                    for (int k = 0; k < 4; k++) {
+                        float p[3];
+                        p[axis] = side * h;
+                        p[u] = -h + size * (i + (k == 1 || k == 2)) / CUBE_DIVISIONS;
+                        p[v] = -h + size * (j + (k >= 2)) / CUBE_DIVISIONS;
+                        q[k] = { p[0], p[1], p[2] };
+                    }
+                    meshQuad(w, q[0], q[1], q[2], q[3], normal, normal, normal, normal);
+                }
+            }
+        }
+    }
+}
+
+bool sameMeshShape(const PartShape& a, const PartShape& b) {
+    return a.shape == b.shape && a.size == b.size && a.height == b.height && a.slices == b.slices && a.stacks == b.stacks;
+}
+
+int meshVertexCount(const PartShape& s) {
+    if (s.shape == SHAPE_SPHERE) return s.slices * s.stacks * 6;
+    if (s.shape == SHAPE_CUBE) return 6 * CUBE_DIVISIONS * CUBE_DIVISIONS * 6;
+    return s.slices * (s.stacks * 6 + 3);
+}
+
+int staticMeshFor(const PartShape& s) {
+    for (int i = 0; i < baked.meshCount; i++)
+        if (sameMeshShape(baked.meshes[i].shape, s)) return i;
+    int count = meshVertexCount(s);
+    if (baked.meshCount >= MAX_STATIC_MESHES || baked.meshVertexCount + count > MAX_STATIC_VERTS) return -1;
+    StaticMesh& m = baked.meshes[baked.meshCount];
+    m.shape = s;
+    m.first = baked.meshVertexCount;
+    m.count = count;
+    baked.meshVertexCount += count;
+    return baked.meshCount++;
+}
+
+uint64_t staticMeshKey() {
+    uint64_t h = HASH_SEED;
+    const int header[] = { MESH_VERSION, CUBE_DIVISIONS, baked.meshCount };
+    h = hashBytes(h, header, sizeof(header));
+    for (int i = 0; i < baked.meshCount; i++) {
+        const PartShape& s = baked.meshes[i].shape;
+        const float shape[] = { (float)s.shape, s.size, s.height, (float)s.slices, (float)s.stacks };
+        h = hashBytes(h, shape, sizeof(shape));
+    }
+    return h;
+}
+
+// Positions for every registered mesh followed by their normals
+void generateStaticMeshes(Vec3* out) {
+    MeshWriter w = { out, out + baked.meshVertexCount, 0 };
+    for (int i = 0; i < baked.meshCount; i++) {
+        const PartShape& s = baked.meshes[i].shape;
+        if (s.shape == SHAPE_SPHERE) buildSphere(w, s.size, s.slices, s.stacks);
+        else if (s.shape == SHAPE_CUBE) buildCube(w, s.size);
+        else buildCone(w, s.size, s.height, s.slices, s.stacks);
+    }
+}
+
+// Returns the instance index, or -1 when the prop has to be drawn lit
+int addBakedInstance(const Mat4& world, const PartShape& s, bool layout) {
+    if (baked.instanceCount >= MAX_BAKED_INSTANCES) return -1;
+    int mesh = staticMeshFor(s);
+    if (mesh < 0 || baked.propColorCount + baked.layoutColorCount + baked.meshes[mesh].count > MAX_BAKED_COLORS) return -1;
+    BakedInstance& inst = baked.instances[baked.instanceCount];
+    int& colorCount = layout ? baked.layoutColorCount : baked.propColorCount;
+    inst.world = world;
+    inst.mesh = mesh;
+    inst.firstColor = colorCount;
+    inst.color = s.color;
+    inst.layout = layout;
+    colorCount += baked.meshes[mesh].count;
+    return baked.instanceCount++;
+}
+
+// Height of the rendered terrain, with the big box occluders standing on it
+float sceneHeight(float x, float z) {
+    float fx = (x + TERRAIN_HALF) / TERRAIN_STEP, fz = (z + TERRAIN_HALF) / TERRAIN_STEP;
+    fx = std::min(std::max(fx, 0.0f), TERRAIN_CELLS - 0.001f);
+    fz = std::min(std::max(fz, 0.0f), TERRAIN_CELLS - 0.001f);
+    int i = (int)fx, j = (int)fz;
+    float u = fx - i, v = fz - j, h;
+    if (u + v <= 1.0f) h = terrainGrid[i][j] + (terrainGrid[i + 1][j] - terrainGrid[i][j]) * u + (terrainGrid[i][j + 1] - terrainGrid[i][j]) * v;
+    else h = terrainGrid[i + 1][j + 1] + (terrainGrid[i][j + 1] - terrainGrid[i + 1][j + 1]) * (1 - u) + (terrainGrid[i + 1][j] - terrainGrid[i + 1][j + 1]) * (1 - v);
+    for (int k = 0; k < occlusion.occluderCount; k++) {
+        const Bounds& b = occlusion.occluders[k];
+        if (x >= b.min.x && x <= b.max.x && z >= b.min.z && z <= b.max.z) h = std::max(h, b.max.y);
+    }
+    return h;
+}
+
+// 1 in full sun, fading to 0 as the path towards the sun grazes or enters the ground
+float bakeSunVisibility(const Vec3& p) {
+    const Vec3 d = baked.sunDir;
+    float horiz = sqrtf(d.x * d.x + d.z * d.z);
+    float clearance = 1e30f;
+    for (float t = SHADOW_STEP; t <= SHADOW_DISTANCE; t += SHADOW_STEP) {
+        float s = t / horiz;   // t is horizontal distance
+        float rayY = p.y + d.y * s;
+        clearance = std::min(clearance, (rayY - sceneHeight(p.x + d.x * s, p.z + d.z * s)) / t);
+        if (clearance < 0.0f) return 0.0f;
+    }
+    return std::min(1.0f, clearance * SHADOW_SOFTNESS);
+}
+
+// Horizon-based: how much of the sky the surrounding ground leaves open
+float bakeTerrainOcclusion(const Vec3& p) {
+    float open = 0.0f;
+    for (int k = 0; k < AO_DIRECTIONS; k++) {
+        float a = 6.28318531f * k / AO_DIRECTIONS, dx = cosf(a), dz = sinf(a);
+        float maxSlope = 0.0f;
+        for (float t = 0.5f * TERRAIN_STEP; t <= AO_DISTANCE; t += 0.5f * TERRAIN_STEP)
+            maxSlope = std::max(maxSlope, (sceneHeight(p.x + dx * t, p.z + dz * t) - p.y) / t);
+        open += 1.0f - maxSlope / sqrtf(1.0f + maxSlope * maxSlope);   // 1 - sin(horizon angle)
+    }
+    return open / AO_DIRECTIONS;
+}
+
+// Cosine-weighted hemisphere rays marched against the scene height
+float bakePropOcclusion(const Vec3& p, const Vec3& n) {
+    Vec3 t = fabsf(n.y) < 0.9f ? vecCross(n, Vec3{ 0, 1, 0 }) : vecCross(n, Vec3{ 1, 0, 0 });
+    vecNormalize(t);
+    Vec3 b = vecCross(n, t);
+    int open = 0;
+    for (int k = 0; k < AO_RAYS; k++) {
+        // Fixed spiral over the hemisphere so every bake is identical
+        float r = sqrtf((k + 0.5f) / AO_RAYS), phi = k * 2.39996323f;
+        float x = r * cosf(phi), y = r * sinf(phi), z = sqrtf(1.0f - r * r);
+        Vec3 dir = vecAdd(vecAdd(vecScale(t, x), vecScale(b, y)), vecScale(n, z));
+        bool hit = false;
+        for (float s = 0.25f; s <= AO_DISTANCE * 0.5f && !hit; s += 0.25f) {
+            Vec3 q = vecAdd(p, vecScale(dir, s));
+            hit = q.y < sceneHeight(q.x, q.z);
+        }
+        if (!hit) open++;
+    }
+    return open / (float)AO_RAYS;
+}
+
+void bakeColor(unsigned char* out, const Vec3& base, const Vec3& n, float sun, float ao) {
+    float diffuse = std::max(0.0f, n.x * baked.sunDir.x + n.y * baked.sunDir.y + n.z * baked.sunDir.z) * sun;
+    float light[3] = { BAKE_AMBIENT.x * ao + BAKE_SUN.x * diffuse, BAKE_AMBIENT.y * ao + BAKE_SUN.y * diffuse, BAKE_AMBIENT.z * ao + BAKE_SUN.z * diffuse };
+    float c[3] = { base.x * light[0], base.y * light[1], base.z * light[2] };
+    for (int k = 0; k < 3; k++) out[k] = (unsigned char)(std::min(1.0f, c[k]) * 255.0f + 0.5f);
+}
+
+const Vec3 TERRAIN_COLOR = { 0.2f, 0.5f, 0.2f };
+
+// Bake output before it is stored: terrain, fixed props, then layout props.
+// Only touched on a cache miss.
+unsigned char bakeScratch[(TERRAIN_CELLS + 1) * (TERRAIN_CELLS + 1) + MAX_BAKED_COLORS][3];
+
+// One job per grid row
+void bakeTerrainRow(int i, void* ctx) {
+    (void)ctx;
+    for (int j = 0; j <= TERRAIN_CELLS; j++) {
+        int il = std::max(i - 1, 0), ih = std::min(i + 1, TERRAIN_CELLS);
+        int jl = std::max(j - 1, 0), jh = std::min(j + 1, TERRAIN_CELLS);
+        Vec3 n = { -(terrainGrid[ih][j] - terrainGrid[il][j]) / ((ih - il) * TERRAIN_STEP), 1.0f,
+            -(terrainGrid[i][jh] - terrainGrid[i][jl]) / ((jh - jl) * TERRAIN_STEP) };
+        vecNormalize(n);
+        Vec3 p = { -TERRAIN_HALF + i * TERRAIN_STEP, terrainGrid[i][j], -TERRAIN_HALF + j * TERRAIN_STEP };
+        Vec3 lifted = { p.x, p.y + 0.05f, p.z };
+        bakeColor(bakeScratch[i * (TERRAIN_CELLS + 1) + j], TERRAIN_COLOR, n, bakeSunVisibility(lifted), bakeTerrainOcclusion(p));
+    }
+}
+
+// One job per prop; ctx says whether this pass bakes the layout props
+void bakeInstance(int index, void* ctx) {
+    const BakedInstance& inst = baked.instances[index];
+    if (inst.layout != *(const bool*)ctx) return;
+    int base = (TERRAIN_CELLS + 1) * (TERRAIN_CELLS + 1) + (inst.layout ? baked.propColorCount : 0) + inst.firstColor;
+    const StaticMesh& mesh = baked.meshes[inst.mesh];
+    const float* m = inst.world.m;
+    // Cofactors of the upper 3x3: the inverse transpose up to scale, fine for normals
+    float cof[9] = {
+        m[5] * m[10] - m[6] * m[9], m[6] * m[8] - m[4] * m[10], m[4] * m[9] - m[5] * m[8],
+        m[2] * m[9] - m[1] * m[10], m[0] * m[10] - m[2] * m[8], m[1] * m[8] - m[0] * m[9],
+        m[1] * m[6] - m[2] * m[5], m[2] * m[4] - m[0] * m[6], m[0] * m[5] - m[1] * m[4] };
+    for (int v = 0; v < mesh.count; v++) {
+        const Vec3& lp = baked.meshPos[mesh.first + v];
+        const Vec3& ln = baked.meshNormal[mesh.first + v];
+        Vec3A wp = mat4TransformPoint(inst.world, Vec3A(lp));
+        Vec3 n = { cof[0] * ln.x + cof[3] * ln.y + cof[6] * ln.z,
+            cof[1] * ln.x + cof[4] * ln.y + cof[7] * ln.z,
+            cof[2] * ln.x + cof[5] * ln.y + cof[8] * ln.z };
+        vecNormalize(n);
+        Vec3 p = { wp.x + n.x * 0.05f, wp.y + n.y * 0.05f, wp.z + n.z * 0.05f };
+        bakeColor(bakeScratch[base + v], inst.color, n, bakeSunVisibility(p), bakePropOcclusion(p, n));
+    }
+}
+
+// Everything the fixed or the layout colors depend on
+uint64_t bakeKey(bool layout) {
+    uint64_t h = HASH_SEED;
+    const int version = BAKE_VERSION;
+    const float settings[] = { TERRAIN_HALF, TERRAIN_STEP, SHADOW_STEP, SHADOW_DISTANCE, SHADOW_SOFTNESS, AO_DISTANCE,
+        AO_DIRECTIONS, AO_RAYS, CUBE_DIVISIONS, BAKE_AMBIENT.x, BAKE_AMBIENT.y, BAKE_AMBIENT.z, BAKE_SUN.x, BAKE_SUN.y, BAKE_SUN.z,
+        baked.sunDir.x, baked.sunDir.y, baked.sunDir.z, TERRAIN_COLOR.x, TERRAIN_COLOR.y, TERRAIN_COLOR.z };
+    h = hashBytes(h, &version, sizeof(version));
+    h = hashBytes(h, settings, sizeof(settings));
+    h = hashBytes(h, terrainGrid, sizeof(terrainGrid));
+    h = hashBytes(h, occlusion.occluders, occlusion.occluderCount * sizeof(Bounds));   // they shadow the scene
+    h = hashBytes(h, &layout, sizeof(layout));
+    for (int i = 0; i < baked.instanceCount; i++) {
+        const BakedInstance& inst = baked.instances[i];
+        if (inst.layout != layout) continue;
+        const PartShape& s = baked.meshes[inst.mesh].shape;
+        const float shape[] = { (float)s.shape, s.size, s.height, (float)s.slices, (float)s.stacks };
+        h = hashBytes(h, inst.world.m, sizeof(inst.world.m));
+        h = hashBytes(h, &inst.color, sizeof(inst.color));
+        h = hashBytes(h, shape, sizeof(shape));
+    }
+    return h;
+}
+
+// Call once the terrain grid and the static meshes are loaded.
+void bakeLighting() {
+    double start = preciseSeconds();
+    Vec3 sun = sunOffset();
+    vecNormalize(sun);
+    baked.sunDir = sun;
+    baked.key = bakeKey(false);
+    const int terrainVerts = (TERRAIN_CELLS + 1) * (TERRAIN_CELLS + 1);
+    size_t bytes = (size_t)(terrainVerts + baked.propColorCount) * 3;
+    const unsigned char (*colors)[3] = (const unsigned char (*)[3])assetLoad(baked.key, bytes);
+    baked.fromCache = colors != 0;
+    if (!colors) {
+        const bool layout = false;
+        parallelFor(TERRAIN_CELLS + 1, bakeTerrainRow, 0);
+        parallelFor(baked.instanceCount, bakeInstance, (void*)&layout);
+        assetStore(baked.key, bakeScratch, bytes);
+        colors = bakeScratch;
+    }
+    baked.terrainColors = colors;
+    baked.propColors = colors + terrainVerts;
+
+    baked.layoutKey = bakeKey(true);
+    size_t layoutBytes = (size_t)baked.layoutColorCount * 3;
+    const unsigned char (*layoutColors)[3] = 0;
+    if (layoutBytes > 0 && baked.storeLayout) layoutColors = (const unsigned char (*)[3])assetLoad(baked.layoutKey, layoutBytes);
+    baked.layoutFromCache = layoutColors != 0;
+    if (!layoutColors) {
+        const bool layout = true;
+        layoutColors = bakeScratch + terrainVerts + baked.propColorCount;
+        parallelFor(baked.instanceCount, bakeInstance, (void*)&layout);
+        if (layoutBytes > 0 && baked.storeLayout) assetStore(baked.layoutKey, layoutColors, layoutBytes);
+    }
+    baked.layoutColors = layoutColors;
+    baked.ms = (preciseSeconds() - start) * 1000.0;
+}
+// --------------------------------------------------------------
+
+// ---------------------- STARTUP ASSETS -------------------------
+// Everything procedural the first frame needs. Each asset is looked up in
+// the asset cache; the missing ones are generated together on the job pool
+// and stored, so a warm start only maps files.
+// Bump the version of any generator whose code changes; the key then changes
+// with it and the stale file is never looked up again
+#define SKY_TEXTURE_VERSION 1
+#define SKYDOME_VERSION 1
+#define TERRAIN_MESH_VERSION 1
+#define SKY_TEX_SIZE 256
+#define SKY_MIP_LEVELS 9                                 // 256 down to 1
+#define SKY_TEX_TEXELS ((SKY_TEX_SIZE * SKY_TEX_SIZE * 4 - 1) / 3)   // all levels
+#define SKYDOME_SEGMENTS 32
+#define SKYDOME_RADIUS 150.0f
+#define SKYDOME_STRIP ((SKYDOME_SEGMENTS * 2 + 1) * 2)   // vertices per ring
+
+struct SkyVertex { float u, v, x, y, z; };
+
+struct TerrainMesh {
+    Vec3 verts[(TERRAIN_CELLS + 1) * (TERRAIN_CELLS + 1)];
+    uint16_t sectorIndices[TERRAIN_SECTORS * TERRAIN_SECTORS][SECTOR_CELLS * SECTOR_CELLS * 6];
+};
+
+enum AssetId { ASSET_SKY_TEXTURE, ASSET_SKYDOME, ASSET_TERRAIN, ASSET_PROP_MESHES, ASSET_COUNT };
+
+struct StartupAsset {
+    uint64_t key;
+    size_t size;
+    void* scratch;              // where a miss is generated
+    void (*generate)(void* out);
+    const void* data;           // mapped file or scratch
+};
+
+struct Assets {
+    StartupAsset list[ASSET_COUNT];
+    const unsigned char* skyPixels = 0;   // RGB, every mip level, largest first
+    const SkyVertex* skydome = 0;         // SKYDOME_SEGMENTS strips
+    const TerrainMesh* terrain = 0;
+    int generated = 0;
+    double ms = 0.0;
+};
+Assets assets;
+
+struct StartupTimes {
+    double begin = 0.0;
+    double windowMs = 0.0, firstFrameMs = 0.0;
+};
+StartupTimes startup;
+
+// Only written on a cache miss
+unsigned char skyScratch[SKY_TEX_TEXELS][3];
+SkyVertex skydomeScratch[SKYDOME_SEGMENTS * SKYDOME_STRIP];
+TerrainMesh terrainScratch;
+Vec3 propMeshScratch[2 * MAX_STATIC_VERTS];
+
+void generateSkyTexture(void* out) {
+    unsigned char (*pixels)[3] = (unsigned char (*)[3])out;
+    for (int y = 0; y < SKY_TEX_SIZE; ++y) {
+        float t = y / (float)(SKY_TEX_SIZE - 1);
+        float r, g, b;
+        if (t < 0.5f) {
+            float s = t * 2.0f;
+            r = 0.1f + 0.3f * s;
+            g = 0.2f + 0.4f * s;
+            b = 0.5f + 0.4f * s;
+        }
+        else {
+            float s = (t - 0.5f) * 2.0f;
+            r = 0.4f + 0.5f * s;
+            g = 0.6f + 0.3f * s;
+            b = 0.9f + 0.05f * s;
+        }
+        for (int x = 0; x < SKY_TEX_SIZE; ++x) {
+            pixels[y * SKY_TEX_SIZE + x][0] = (unsigned char)(r * 255);
+            pixels[y * SKY_TEX_SIZE + x][1] = (unsigned char)(g * 255);
+            pixels[y * SKY_TEX_SIZE + x][2] = (unsigned char)(b * 255);
+        }
+    }
+
+    // 2x2 box filter down to 1x1
+    unsigned char (*src)[3] = pixels;
+    for (int size = SKY_TEX_SIZE / 2; size >= 1; size /= 2) {
+        unsigned char (*dst)[3] = src + size * size * 4;
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++)
+                for (int c = 0; c < 3; c++) {
+                    int w = size * 2;
+                    int sum = src[(2 * y) * w + 2 * x][c] + src[(2 * y) * w + 2 * x + 1][c] +
+                        src[(2 * y + 1) * w + 2 * x][c] + src[(2 * y + 1) * w + 2 * x + 1][c];
+                    dst[y * size + x][c] = (unsigned char)((sum + 2) / 4);
+                }
+        src = dst;
+    }
+}
+
+void generateSkydome(void* out) {
+    SkyVertex* v = (SkyVertex*)out;
+    const int seg = SKYDOME_SEGMENTS;
+    for (int i = 0; i < seg; ++i) {
+        float theta1 = (i / float(seg)) * 3.14159f * 0.5f;
+        float theta2 = ((i + 1) / float(seg)) * 3.14159f * 0.5f;
+        for (int j = 0; j <= seg * 2; ++j) {
+            float phi = (j / float(seg * 2)) * 6.28318f;
+            for (int t = 0; t < 2; ++t) {
+                float th = (t == 0 ? theta1 : theta2);
+                v->u = phi / 6.28318f;
+                v->v = th / (3.14159f * 0.5f);
+                v->x = SKYDOME_RADIUS * cosf(th) * cosf(phi);
+                v->y = SKYDOME_RADIUS * sinf(th);
+                v->z = SKYDOME_RADIUS * cosf(th) * sinf(phi);
+                v++;
+            }
+        }
+    }
+}
+
+void generateTerrain(void* out) {
+    TerrainMesh* mesh = (TerrainMesh*)out;
+    for (int i = 0; i <= TERRAIN_CELLS; i++)
+        for (int j = 0; j <= TERRAIN_CELLS; j++) {
+            float x = -TERRAIN_HALF + i * TERRAIN_STEP, z = -TERRAIN_HALF + j * TERRAIN_STEP;
+            mesh->verts[i * (TERRAIN_CELLS + 1) + j] = { x, terrainHeight(x, z), z };
+        }
+    for (int s = 0; s < TERRAIN_SECTORS * TERRAIN_SECTORS; s++) {
+        uint16_t* idx = mesh->sectorIndices[s];
+        int i0 = (s % TERRAIN_SECTORS) * SECTOR_CELLS, j0 = (s / TERRAIN_SECTORS) * SECTOR_CELLS;
+        for (int i = i0; i < i0 + SECTOR_CELLS; i++) {
+            for (int j = j0; j < j0 + SECTOR_CELLS; j++) {
+                uint16_t v00 = (uint16_t)(i * (TERRAIN_CELLS + 1) + j), v10 = (uint16_t)(v00 + TERRAIN_CELLS + 1);
+                *idx++ = v00; *idx++ = v10; *idx++ = (uint16_t)(v00 + 1);
+                *idx++ = v10; *idx++ = (uint16_t)(v10 + 1); *idx++ = (uint16_t)(v00 + 1);
+            }
+        }
+    }
+}
+
+void generatePropMeshes(void* out) { generateStaticMeshes((Vec3*)out); }
+
+// terrainHeight() is code, not data: the key holds its value at every vertex
+// the mesh samples, so any change the mesh could show changes the key
+uint64_t terrainKey() {
+    uint64_t h = HASH_SEED;
+    const float shape[] = { TERRAIN_MESH_VERSION, TERRAIN_HALF, TERRAIN_STEP, TERRAIN_CELLS, TERRAIN_SECTORS };
+    h = hashBytes(h, shape, sizeof(shape));
+    static float heights[(TERRAIN_CELLS + 1) * (TERRAIN_CELLS + 1)];
+    for (int i = 0; i <= TERRAIN_CELLS; i++)
+        for (int j = 0; j <= TERRAIN_CELLS; j++)
+            heights[i * (TERRAIN_CELLS + 1) + j] = terrainHeight(-TERRAIN_HALF + i * TERRAIN_STEP, -TERRAIN_HALF + j * TERRAIN_STEP);
+    return h ^ hashPayload(heights, sizeof(heights));
+}
+
+uint64_t assetKey(int id, int version, const float* params, size_t bytes) {
+    uint64_t h = HASH_SEED;
+    const int header[] = { version, id };
+    h = hashBytes(h, header, sizeof(header));
+    return hashBytes(h, params, bytes);
+}
+
+void generateAssetJob(int index, void* ctx) {
+    StartupAsset* a = ((StartupAsset**)ctx)[index];
+    a->generate(a->scratch);
+}
+
+// Call after every static prop has been added.
+void loadAssets() {
+    double start = preciseSeconds();
+    const float sky[] = { SKY_TEX_SIZE, SKY_MIP_LEVELS };
+    const float dome[] = { SKYDOME_SEGMENTS, SKYDOME_RADIUS };
+    StartupAsset* list = assets.list;
+    list[ASSET_SKY_TEXTURE] = { assetKey(ASSET_SKY_TEXTURE, SKY_TEXTURE_VERSION, sky, sizeof(sky)), sizeof(skyScratch), skyScratch, generateSkyTexture, 0 };
+    list[ASSET_SKYDOME] = { assetKey(ASSET_SKYDOME, SKYDOME_VERSION, dome, sizeof(dome)), sizeof(skydomeScratch), skydomeScratch, generateSkydome, 0 };
+    list[ASSET_TERRAIN] = { terrainKey(), sizeof(TerrainMesh), &terrainScratch, generateTerrain, 0 };
+    list[ASSET_PROP_MESHES] = { staticMeshKey(), sizeof(Vec3) * 2 * baked.meshVertexCount, propMeshScratch, generatePropMeshes, 0 };
+
+    StartupAsset* missing[ASSET_COUNT];
+    int missingCount = 0;
+    for (int i = 0; i < ASSET_COUNT; i++) {
+        list[i].data = assetLoad(list[i].key, list[i].size);
+        if (!list[i].data) missing[missingCount++] = &list[i];
+    }
+    parallelFor(missingCount, generateAssetJob, missing);
+    for (int i = 0; i < missingCount; i++) {
+        assetStore(missing[i]->key, missing[i]->scratch, missing[i]->size);
+        missing[i]->data = missing[i]->scratch;
+    }
+    assets.generated = missingCount;
+
+    assets.skyPixels = (const unsigned char*)list[ASSET_SKY_TEXTURE].data;
+    assets.skydome = (const SkyVertex*)list[ASSET_SKYDOME].data;
+    assets.terrain = (const TerrainMesh*)list[ASSET_TERRAIN].data;
+    baked.meshPos = (const Vec3*)list[ASSET_PROP_MESHES].data;
+    baked.meshNormal = baked.meshPos + baked.meshVertexCount;
+    assets.ms = (preciseSeconds() - start) * 1000.0;
+}
+
+void uploadSkyTexture() {
+    glGenTextures(1, &skyTex);
+    glBindTexture(GL_TEXTURE_2D, skyTex);
+    const unsigned char* level = assets.skyPixels;
+    for (int l = 0, size = SKY_TEX_SIZE; l < SKY_MIP_LEVELS; l++, size /= 2) {
+        glTexImage2D(GL_TEXTURE_2D, l, GL_RGB, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, level);
+        level += size * size * 3;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, 0x812F);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, 0x812F);
+}
+// --------------------------------------------------------------
+
+// ---------------------- ENTITIES -------------------------
+// Archetype storage: each distinct component set is an archetype whose
+// entities live in fixed 16 KB chunks holding one packed array per component,
+// so a system streams only the columns it uses. Chunks come from a static
+// pool and are recycled, nothing here touches the heap after startup.
+//
+// Systems declare up to two queries plus the components (and shared
+// resources such as the player or the RNG) they read and write. Systems that
+// cannot touch the same data share a stage and run on the job pool; spawns,
+// destroys and archetype moves requested while systems run are queued and
+// applied between stages, each system's queue in registration order.
+#define CHUNK_BYTES (16 * 1024)
+#define MAX_CHUNKS 64
+#define MAX_ARCHETYPES 16
+#define MAX_ENTITIES 4096
+#define MAX_COMPONENTS 16
+#define MAX_DEFERRED 1024       // per system
+#define MAX_SYSTEMS 16
+#define BIT(c) (1u << (c))
+
+// Resource bits share the access masks with component bits
+#define RES_PLAYER (1u << 30)
+#define RES_RNG (1u << 31)
+#define RES_MASK (RES_PLAYER | RES_RNG)
+
+typedef uint32_t Entity;   // generation << 16 | slot
+const Entity NULL_ENTITY = 0xFFFFFFFFu;
+
+struct Archetype;
+struct Chunk {
+    Archetype* archetype;
+    int count;
+    alignas(64) unsigned char data[CHUNK_BYTES];
+};
+
+struct Archetype {
+    uint32_t mask;
+    const char* name;
+    int capacity;                 // entities per chunk
+    int offsets[MAX_COMPONENTS];  // column offsets in Chunk::data, -1 if absent
+    Chunk* chunks[MAX_CHUNKS];
+    int chunkCount;
+    int entityCount;
+};
+
+struct EntityRecord { Chunk* chunk; int row; uint16_t generation; };
+
+struct World {
+    int componentSize[MAX_COMPONENTS];
+    Archetype archetypes[MAX_ARCHETYPES];
+    int archetypeCount = 0;
+    Chunk chunkPool[MAX_CHUNKS];
+    Chunk* freeChunks[MAX_CHUNKS];
+    int freeChunkCount = 0;
+    EntityRecord records[MAX_ENTITIES];
+    uint16_t freeSlots[MAX_ENTITIES];
+    int freeSlotCount = 0;
+};
+World world;
+
+void initWorld() {
+    world.freeChunkCount = 0;
+    for (int i = MAX_CHUNKS - 1; i >= 0; i--) world.freeChunks[world.freeChunkCount++] = &world.chunkPool[i];
+    world.freeSlotCount = 0;
+    for (int i = MAX_ENTITIES - 1; i >= 0; i--) {
+        world.records[i].chunk = 0;
+        world.records[i].generation = 0;
+        world.freeSlots[world.freeSlotCount++] = (uint16_t)i;
+    }
+}
+
+void registerComponent(int id, int size) { world.componentSize[id] = size; }
+
+Archetype* registerArchetype(uint32_t mask, const char* name) {
+    Archetype& a = world.archetypes[world.archetypeCount++];
+    a.mask = mask;
+    a.name = name;
+    a.chunkCount = a.entityCount = 0;
+    int perEntity = sizeof(Entity), columns = 1;
+    for (int c = 0; c < MAX_COMPONENTS; c++)
+        if (mask & BIT(c)) { perEntity += world.componentSize[c]; columns++; }
+    a.capacity = (CHUNK_BYTES - columns * 16) / perEntity;
+    int offset = ((int)sizeof(Entity) * a.capacity + 15) & ~15; // entity ids first
+    for (int c = 0; c < MAX_COMPONENTS; c++) {
+        a.offsets[c] = -1;
+        if (!(mask & BIT(c))) continue;
+        a.offsets[c] = offset;
+        offset = (offset + world.componentSize[c] * a.capacity + 15) & ~15;
+    }
+    return &a;
+}
+
+inline Entity* chunkEntities(Chunk* c) { return (Entity*)c->data; }
+template <typename T> inline T* column(Chunk* c, int comp) { return (T*)(c->data + c->archetype->offsets[comp]); }
+
+inline bool entityAlive(Entity e) {
+    if (e == NULL_ENTITY) return false;
+    const EntityRecord& r = world.records[e & 0xFFFF];
+    return r.chunk && r.generation == (e >> 16);
+}
+
+template <typename T> T* getComponent(Entity e, int comp) {
+    const EntityRecord& r = world.records[e & 0xFFFF];
+    return column<T>(r.chunk, comp) + r.row;
+}
+
+// Appends a row (components uninitialized); returns NULL_ENTITY when out of room.
+Entity createEntity(Archetype* a) {
+    if (world.freeSlotCount == 0) return NULL_ENTITY;
+    Chunk* c = a->chunkCount ? a->chunks[a->chunkCount - 1] : 0;
+    if (!c || c->count == a->capacity) {
+        if (world.freeChunkCount == 0) return NULL_ENTITY;
+        c = world.freeChunks[--world.freeChunkCount];
+        c->archetype = a;
+        c->count = 0;
+        a->chunks[a->chunkCount++] = c;
+    }
+    uint16_t slot = world.freeSlots[--world.freeSlotCount];
+    EntityRecord& r = world.records[slot];
+    r.chunk = c;
+    r.row = c->count++;
+    Entity e = ((Entity)r.generation << 16) | slot;
+    chunkEntities(c)[r.row] = e;
+    a->entityCount++;
+    return e;
+}
+
+// Swap-removes a row, keeping every column packed.
+void removeRow(Chunk* c, int row) {
+    Archetype* a = c->archetype;
+    int last = c->count - 1;
+    if (row != last) {
+        Entity moved = chunkEntities(c)[last];
+        chunkEntities(c)[row] = moved;
+        for (int comp = 0; comp < MAX_COMPONENTS; comp++) {
+            int size = world.componentSize[comp];
+            if (a->offsets[comp] < 0 || size == 0) continue;
+            unsigned char* base = c->data + a->offsets[comp];
+            memcpy(base + row * size, base + last * size, size);
+        }
+        world.records[moved & 0xFFFF].row = row;
+    }
+    c->count--;
+    a->entityCount--;
+    if (c->count == 0) {
+        for (int i = 0; i < a->chunkCount; i++)
+            if (a->chunks[i] == c) { a->chunks[i] = a->chunks[--a->chunkCount]; break; }
+        world.freeChunks[world.freeChunkCount++] = c;
+    }
+}
+
+void destroyEntity(Entity e) {
+    if (!entityAlive(e)) return;
+    EntityRecord& r = world.records[e & 0xFFFF];
+    removeRow(r.chunk, r.row);
+    r.chunk = 0;
+    r.generation++;
+    world.freeSlots[world.freeSlotCount++] = (uint16_t)(e & 0xFFFF);
+}
+
+// Moves an entity to another archetype, keeping the components both share.
+// The entity id stays valid.
+bool moveEntity(Entity e, Archetype* to) {
+    if (!entityAlive(e)) return false;
+    EntityRecord& r = world.records[e & 0xFFFF];
+    Chunk* from = r.chunk;
+    int fromRow = r.row;
+    Entity tmp = createEntity(to);
+    if (tmp == NULL_ENTITY) return false;
+    EntityRecord& t = world.records[tmp & 0xFFFF];
+    for (int comp = 0; comp < MAX_COMPONENTS; comp++) {
+        int size = world.componentSize[comp];
+        if (size == 0 || from->archetype->offsets[comp] < 0 || to->offsets[comp] < 0) continue;
+        memcpy(t.chunk->data + to->offsets[comp] + t.row * size, from->data + from->archetype->offsets[comp] + fromRow * size, size);
+    }
+    // Hand the new row over to e and recycle the temporary id
+    removeRow(from, fromRow);
+    r.chunk = t.chunk;
+    r.row = t.row;
+    chunkEntities(t.chunk)[t.row] = e;
+    t.chunk = 0;
+    t.generation++;
+    world.freeSlots[world.freeSlotCount++] = (uint16_t)(tmp & 0xFFFF);
+    return true;
+}
+
+// Destroys every entity of an archetype
+void clearArchetype(Archetype* a) {
+    while (a->chunkCount) {
+        Chunk* c = a->chunks[a->chunkCount - 1];
+        destroyEntity(chunkEntities(c)[c->count - 1]);
+    }
+}
+
+template <typename F> void forEachChunk(uint32_t query, F fn) {
+    for (int i = 0; i < world.archetypeCount; i++) {
+        Archetype& a = world.archetypes[i];
+        if ((a.mask & query) != query) continue;
+        for (int k = 0; k < a.chunkCount; k++) fn(a.chunks[k]);
+    }
+}
+
+int countEntities(uint32_t query) {
+    int n = 0;
+    for (int i = 0; i < world.archetypeCount; i++)
+        if ((world.archetypes[i].mask & query) == query) n += world.archetypes[i].entityCount;
+    return n;
+}
+
+// Structural changes requested from inside systems
+enum DeferredKind { DEFER_DESTROY, DEFER_MOVE, DEFER_SPAWN };
+struct DeferredOp;
+typedef void (*DeferredInit)(Entity e, const DeferredOp& op);
+
+struct DeferredOp {
+    int kind;
+    Entity entity;
+    Archetype* target;
+    DeferredInit init;   // fills the new components after spawn/move
+    Vec3 a, b;
+    float f;
+    int i;
+};
+
+// A queue is only ever filled by the one thread running its system, so the
+// order of a flush (and of the RNG draws and entity rows it causes) does not
+// depend on how a stage was spread over the workers.
+struct DeferredQueue {
+    DeferredOp ops[MAX_DEFERRED];
+    int count = 0;
+};
+struct Deferred {
+    DeferredQueue queues[MAX_SYSTEMS + 1];   // [0] is for requests made outside any system
+    int overflow = 0;
+};
+Deferred deferred;
+thread_local int deferQueue = 0;             // 1 + the system running on this thread
+
+DeferredOp* defer(int kind, Entity e, Archetype* target, DeferredInit init) {
+    DeferredQueue& q = deferred.queues[deferQueue];
+    if (q.count >= MAX_DEFERRED) { deferred.overflow++; return 0; }
+    DeferredOp& op = q.ops[q.count++];
+    op.kind = kind; op.entity = e; op.target = target; op.init = init;
+    return &op;
+}
+
+void flushDeferred() {
+    for (int i = 0; i <= MAX_SYSTEMS; i++) {
+        DeferredQueue& q = deferred.queues[i];
+        for (int k = 0; k < q.count; k++) {
+            const DeferredOp& op = q.ops[k];
+            if (op.kind == DEFER_DESTROY) destroyEntity(op.entity);
+            else if (op.kind == DEFER_MOVE) { if (moveEntity(op.entity, op.target) && op.init) op.init(op.entity, op); }
+            else if (op.init) op.init(NULL_ENTITY, op); // spawns create their own entity (pool limits live there)
+        }
+        q.count = 0;
+    }
+}
+
+// Systems and the stage schedule
+typedef void (*SystemFn)(float dt, float t);
+
+struct System {
+    const char* name;
+    uint32_t queries[2];
+    uint32_t reads, writes;
+    SystemFn run;
+    int stage;
+};
+
+struct Scheduler {
+    System systems[MAX_SYSTEMS];
+    int systemCount = 0;
+    int stageCount = 0;
+    float dt = 0.0f, t = 0.0f;
+    int stageMembers[MAX_SYSTEMS];
+    double tickMs = 0.0;
+};
+Scheduler scheduler;
+
+bool queriesOverlap(uint32_t qa, uint32_t qb) {
+    if (!qa || !qb) return false;
+    for (int i = 0; i < world.archetypeCount; i++) {
+        uint32_t m = world.archetypes[i].mask;
+        if ((m & qa) == qa && (m & qb) == qb) return true;
+    }
+    return false;
+}
+
+bool systemsConflict(const System& a, const System& b) {
+    uint32_t aAll = a.reads | a.writes, bAll = b.reads | b.writes;
+    uint32_t clash = (a.writes & bAll) | (b.writes & aAll);
+    if (clash & RES_MASK) return true;
+    if (!(clash & ~RES_MASK)) return false;
+    for (int i = 0; i < 2; i++)
+        for (int j = 0; j < 2; j++)
+            if (queriesOverlap(a.queries[i], b.queries[j])) return true;
+    return false;
+}
+
+// Registration order is program order: a system lands one stage after the
+// latest earlier system it conflicts with.
+void registerSystem(const char* name, uint32_t query0, uint32_t query1, uint32_t reads, uint32_t writes, SystemFn fn) {
+    System& s = scheduler.systems[scheduler.systemCount];
+    s.name = name;
+    s.queries[0] = query0; s.queries[1] = query1;
+    s.reads = reads; s.writes = writes;
+    s.run = fn;
+    s.stage = 0;
+    for (int i = 0; i < scheduler.systemCount; i++)
+        if (systemsConflict(scheduler.systems[i], s) && scheduler.systems[i].stage + 1 > s.stage)
+            s.stage = scheduler.systems[i].stage + 1;
+    if (s.stage + 1 > scheduler.stageCount) scheduler.stageCount = s.stage + 1;
+    scheduler.systemCount++;
+}
+
+void runSystemJob(int index, void* ctx) {
+    (void)ctx;
+    System& s = scheduler.systems[scheduler.stageMembers[index]];
+    deferQueue = scheduler.stageMembers[index] + 1;
+    s.run(scheduler.dt, scheduler.t);
+    deferQueue = 0;
+}
+
+void runSystems(float dt, float t) {
+    double start = preciseSeconds();
+    scheduler.dt = dt;
+    scheduler.t = t;
+    for (int stage = 0; stage < scheduler.stageCount; stage++) {
+        int n = 0;
+        for (int i = 0; i < scheduler.systemCount; i++)
+            if (scheduler.systems[i].stage == stage) scheduler.stageMembers[n++] = i;
+        parallelFor(n, runSystemJob, 0);
+        flushDeferred();
+    }
+    scheduler.tickMs = (preciseSeconds() - start) * 1000.0;
+    metricsRecord(HIST_TICK, (uint64_t)(scheduler.tickMs * 1000.0));
+}
+// --------------------------------------------------------------
+
+// ---------------------- GAME ENTITIES -------------------------
+enum ComponentId {
+    COMP_POSITION,        // Vec3
+    COMP_MOTION,          // Vec3: heading for bullets and enemies, velocity for particles
+    COMP_LIFETIME,        // float, seconds left
+    COMP_BULLET,          // BulletInfo
+    COMP_PARTICLE,        // tag
+    COMP_ENEMY,           // EnemyCombat, touched every tick
+    COMP_ENEMY_MEMORY,    // EnemyMemory, vision bookkeeping
+    COMP_RESPAWN,         // float, seconds until a dead enemy returns
+    COMP_MODELVIEW,       // Mat4, rebuilt every frame
+    COMP_PART_MODELVIEWS, // EnemyPartMatrices, rebuilt every frame
+    COMP_WORLD,           // Mat4, static props
+    COMP_SHAPE,           // PartShape
+    COMP_BOUNDS,          // Bounds, world space
+    COMP_BAKED,           // int, baked instance or -1 if drawn lit
+    COMP_COUNT
+};
+
+struct BulletInfo { int owner; }; // 0 = player, 1 = enemy
+struct EnemyCombat { float health, flashTimer, shootCooldown; };
+struct EnemyMemory { Vec3 lastSeenPos; float lastSeenTime; bool canSeePlayer; };
+struct EnemyPartMatrices { Mat4 parts[ENEMY_PARTS]; };
+
+// Shared by every enemy, so not stored per entity
+const float ENEMY_SIZE = 0.4f;
+const float ENEMY_MOVE_SPEED = 0.8f;
+const float ENEMY_MAX_SHOOT_COOLDOWN = 2.0f;
+const float BULLET_SPEED = 15.0f;
+const float BULLET_DAMAGE = 34.0f;   // body shot, scaled per hit part
+// Box around every part, relative to the enemy's position
+const Vec3 ENEMY_BOX_MIN = { -0.5f, 0.0f, -0.5f };
+const Vec3 ENEMY_BOX_MAX = { 0.5f, 1.75f, 0.5f };
+
+const uint32_t Q_ENEMY = BIT(COMP_ENEMY);
+const uint32_t Q_DEAD_ENEMY = BIT(COMP_RESPAWN);
+const uint32_t Q_BULLET = BIT(COMP_BULLET);
+const uint32_t Q_PARTICLE = BIT(COMP_PARTICLE);
+const uint32_t Q_PROP = BIT(COMP_WORLD);
+
+Archetype* archEnemy;
+Archetype* archDeadEnemy;
+Archetype* archBullet;
+Archetype* archParticle;
+Archetype* archProp;
+
+void initEntityTypes() {
+    initWorld();
+    registerComponent(COMP_POSITION, sizeof(Vec3));
+    registerComponent(COMP_MOTION, sizeof(Vec3));
+    registerComponent(COMP_LIFETIME, sizeof(float));
+    registerComponent(COMP_BULLET, sizeof(BulletInfo));
+    registerComponent(COMP_PARTICLE, 0);
+    registerComponent(COMP_ENEMY, sizeof(EnemyCombat));
+    registerComponent(COMP_ENEMY_MEMORY, sizeof(EnemyMemory));
+    registerComponent(COMP_RESPAWN, sizeof(float));
+    registerComponent(COMP_MODELVIEW, sizeof(Mat4));
+    registerComponent(COMP_PART_MODELVIEWS, sizeof(EnemyPartMatrices));
+    registerComponent(COMP_WORLD, sizeof(Mat4));
+    registerComponent(COMP_SHAPE, sizeof(PartShape));
+    registerComponent(COMP_BOUNDS, sizeof(Bounds));
+    registerComponent(COMP_BAKED, sizeof(int));
+
+    archEnemy = registerArchetype(BIT(COMP_POSITION) | BIT(COMP_MOTION) | BIT(COMP_ENEMY) | BIT(COMP_ENEMY_MEMORY) | BIT(COMP_PART_MODELVIEWS), "enemy");
+    archDeadEnemy = registerArchetype(BIT(COMP_POSITION) | BIT(COMP_MOTION) | BIT(COMP_ENEMY_MEMORY) | BIT(COMP_RESPAWN), "dead enemy");
+    archBullet = registerArchetype(BIT(COMP_POSITION) | BIT(COMP_MOTION) | BIT(COMP_LIFETIME) | BIT(COMP_BULLET) | BIT(COMP_MODELVIEW), "bullet");
+    archParticle = registerArchetype(BIT(COMP_POSITION) | BIT(COMP_MOTION) | BIT(COMP_LIFETIME) | BIT(COMP_PARTICLE) | BIT(COMP_MODELVIEW), "particle");
+    archProp = registerArchetype(BIT(COMP_WORLD) | BIT(COMP_SHAPE) | BIT(COMP_BOUNDS) | BIT(COMP_BAKED) | BIT(COMP_MODELVIEW), "prop");
+}
+
+// Static props are composed into a world matrix once
+// layout: placed from the layout seed rather than at a fixed spot
+void addProp(const Mat4& worldMatrix, const PartShape& shape, bool layout = false) {
+    Entity e = createEntity(archProp);
+    if (e == NULL_ENTITY) return;
+    *getComponent<Mat4>(e, COMP_WORLD) = worldMatrix;
+    *getComponent<PartShape>(e, COMP_SHAPE) = shape;
+    *getComponent<Bounds>(e, COMP_BOUNDS) = shapeBounds(worldMatrix, shape);
+    *getComponent<int>(e, COMP_BAKED) = addBakedInstance(worldMatrix, shape, layout);
+    occlusionAddOccluder(worldMatrix, shape);
+}
+// --------------------------------------------------------------
+
+// ---------------------- HITBOXES -------------------------
+// Enemies are hit per part: a sphere for the head, oriented boxes for the
+// body and limbs, derived from the model parts so they match what is drawn.
+// Shots are swept segments from last tick's position to this one, so a fast
+// bullet cannot step over a thin limb between ticks.
+// One bounding capsule per enemy rejects most segments first; survivors are
+// moved into the enemy's frame and run through every part test four
+// segments at a time, structure-of-arrays.
+#define HIT_MAX_SEGMENTS 16384
+#define HIT_MAX_PARTS 8
+#define HIT_MISS 2.0f   // any segment parameter above 1
+
+struct HitPart {
+    int shape;            // SHAPE_SPHERE or SHAPE_CUBE
+    int model;            // enemy part it follows
+    float damage;         // multiplier on a body shot
+    const char* name;
+    float rows[3][4];     // enemy frame -> box frame, where the box is [-1, 1]^3
+    Vec3 center;          // sphere, enemy frame
+    float radius;
+};
+
+struct Hitboxes {
+    HitPart parts[HIT_MAX_PARTS];
+    int count = 0;
+    Vec3 capsuleBase;     // vertical capsule around every part, enemy frame
+    float capsuleHeight, capsuleRadius;
+};
+Hitboxes hitboxes;
+
+// Segments under test and, per segment, the nearest hit
+struct HitBatch {
+    alignas(16) float x0[HIT_MAX_SEGMENTS], y0[HIT_MAX_SEGMENTS], z0[HIT_MAX_SEGMENTS];
+    alignas(16) float dx[HIT_MAX_SEGMENTS], dy[HIT_MAX_SEGMENTS], dz[HIT_MAX_SEGMENTS];
+    float t[HIT_MAX_SEGMENTS];   // along the segment, HIT_MISS if nothing was hit
+    int target[HIT_MAX_SEGMENTS], part[HIT_MAX_SEGMENTS];
+    int count = 0;
+};
+
+// Segments that passed one target's capsule, in that target's frame
+struct HitCandidates {
+    alignas(16) float ox[HIT_MAX_SEGMENTS], oy[HIT_MAX_SEGMENTS], oz[HIT_MAX_SEGMENTS];
+    alignas(16) float dx[HIT_MAX_SEGMENTS], dy[HIT_MAX_SEGMENTS], dz[HIT_MAX_SEGMENTS];
+    alignas(16) float t[HIT_MAX_SEGMENTS];
+    alignas(16) int part[HIT_MAX_SEGMENTS];
+    int index[HIT_MAX_SEGMENTS];
+    int count;
+};
+
+struct HitStats {
+    int segments, pairs, candidates, hits;   // last batch
+    float ms;                                // last collision tick
+};
+
+HitBatch hitBatch;
+HitCandidates hitCandidates;
+HitStats hitStats;
+
+void addHitPart(int model, float damage, const char* name) {
+    const Mat4& m = enemyPartLocal[model];
+    const PartShape& s = enemyPartShape[model];
+    HitPart& h = hitboxes.parts[hitboxes.count++];
+    h.shape = s.shape;
+    h.model = model;
+    h.damage = damage;
+    h.name = name;
+    h.center = { m.m[12], m.m[13], m.m[14] };
+    h.radius = s.size * sqrtf(m.m[0] * m.m[0] + m.m[1] * m.m[1] + m.m[2] * m.m[2]);
+    // A unit cube part spans half a column along each axis
+    for (int i = 0; i < 3; i++) {
+        const float* col = m.m + i * 4;
+        float len2 = col[0] * col[0] + col[1] * col[1] + col[2] * col[2];
+        float half = 0.5f * s.size;
+        for (int k = 0; k < 3; k++) h.rows[i][k] = col[k] / (len2 * half);
+        h.rows[i][3] = -(h.center.x * h.rows[i][0] + h.center.y * h.rows[i][1] + h.center.z * h.rows[i][2]);
+    }
+}
+
+// Call after initModels(); the gun is not a target
+void initHitboxes() {
+    hitboxes.count = 0;
+    addHitPart(0, 2.5f, "head");
+    addHitPart(1, 1.0f, "body");
+    addHitPart(2, 0.5f, "arm");
+    addHitPart(3, 0.5f, "arm");
+    addHitPart(4, 0.75f, "leg");
+    addHitPart(5, 0.75f, "leg");
+
+    // Bounding cylinder of every part's corners, closed by the capsule's caps
+    Vec3 lo = { 1e9f, 1e9f, 1e9f }, hi = { -1e9f, -1e9f, -1e9f };
+    Vec3 corners[HIT_MAX_PARTS * 8];
+    int n = 0;
+    for (int p = 0; p < hitboxes.count; p++) {
+        const HitPart& h = hitboxes.parts[p];
+        const Mat4& m = enemyPartLocal[h.model];
+        for (int c = 0; c < 8; c++) {
+            Vec3 v;
+            if (h.shape == SHAPE_SPHERE) {
+                v = { h.center.x + (c & 1 ? h.radius : -h.radius), h.center.y + (c & 2 ? h.radius : -h.radius), h.center.z + (c & 4 ? h.radius : -h.radius) };
+            }
+            else {
+                Vec3A a = mat4TransformPoint(m, Vec3A(c & 1 ? 0.5f : -0.5f, c & 2 ? 0.5f : -0.5f, c & 4 ? 0.5f : -0.5f));
+                v = { a.x, a.y, a.z };
+            }
+            corners[n++] = v;
+            lo = { fminf(lo.x, v.x), fminf(lo.y, v.y), fminf(lo.z, v.z) };
+            hi = { fmaxf(hi.x, v.x), fmaxf(hi.y, v.y), fmaxf(hi.z, v.z) };
+        }
+    }
+    Vec3 axis = { (lo.x + hi.x) * 0.5f, lo.y, (lo.z + hi.z) * 0.5f };
+    float r2 = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float ddx = corners[i].x - axis.x, ddz = corners[i].z - axis.z;
+        r2 = fmaxf(r2, ddx * ddx + ddz * ddz);
+    }
+    hitboxes.capsuleBase = axis;
+    hitboxes.capsuleHeight = hi.y - lo.y;
+    hitboxes.capsuleRadius = sqrtf(r2);
+}
+
+float clamp01(float v) { return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v); }
+
+// Squared distance between the segment o + s*d and the vertical segment from
+// base up by height (closest points of two segments; d must not be zero)
+float segmentCapsuleDist2(const Vec3& o, const Vec3& d, const Vec3& base, float height) {
+    Vec3 r = vecSub(o, base);
+    float a = d.x * d.x + d.y * d.y + d.z * d.z, e = height * height;
+    float b = d.y * height, c = d.x * r.x + d.y * r.y + d.z * r.z, f = r.y * height;
+    float denom = a * e - b * b;
+    float s = denom > 1e-12f ? clamp01((b * f - c * e) / denom) : 0.0f;
+    float t = (b * s + f) / e;
+    if (t < 0.0f) { t = 0.0f; s = clamp01(-c / a); }
+    else if (t > 1.0f) { t = 1.0f; s = clamp01((b - c) / a); }
+    float px = r.x + d.x * s, py = r.y + d.y * s - height * t, pz = r.z + d.z * s;
+    return px * px + py * py + pz * pz;
+}
+
+// Where the segment o + t*d first touches the part, t in [0, 1], or HIT_MISS
+float segmentPartT(const HitPart& h, const Vec3& o, const Vec3& d) {
+    if (h.shape == SHAPE_SPHERE) {
+        Vec3 r = vecSub(o, h.center);
+        float a = d.x * d.x + d.y * d.y + d.z * d.z;
+        float b = r.x * d.x + r.y * d.y + r.z * d.z;
+        float c = r.x * r.x + r.y * r.y + r.z * r.z - h.radius * h.radius;
+        if (c <= 0.0f) return 0.0f;
+        float disc = b * b - a * c;
+        if (disc < 0.0f) return HIT_MISS;
+        float t = (-b - sqrtf(disc)) / a;
+        return t >= 0.0f && t <= 1.0f ? t : HIT_MISS;
+    }
+    float enter = 0.0f, exit = 1.0f;
+    for (int i = 0; i < 3; i++) {
+        const float* row = h.rows[i];
+        float lo = row[0] * o.x + row[1] * o.y + row[2] * o.z + row[3];
+        float ld = row[0] * d.x + row[1] * d.y + row[2] * d.z;
+        float t1 = (-1.0f - lo) / ld, t2 = (1.0f - lo) / ld;
+        enter = fmaxf(enter, fminf(t1, t2));
+        exit = fminf(exit, fmaxf(t1, t2));
+    }
+    return enter <= exit ? enter : HIT_MISS;
+}
+
+// Reference for the batched path: every segment against every target
+// One segment against every target not marked down (down may be null)
+void hitTestSegment(HitBatch& b, int i, const Vec3* targets, const bool* down, int targetCount) {
+    const float r2 = hitboxes.capsuleRadius * hitboxes.capsuleRadius;
+    b.t[i] = HIT_MISS; b.target[i] = -1; b.part[i] = -1;
+    Vec3 o = { b.x0[i], b.y0[i], b.z0[i] }, d = { b.dx[i], b.dy[i], b.dz[i] };
+    for (int j = 0; j < targetCount; j++) {
+        if (down && down[j]) continue;
+        Vec3 local = vecSub(o, targets[j]);
+        if (segmentCapsuleDist2(local, d, hitboxes.capsuleBase, hitboxes.capsuleHeight) > r2) continue;
+        for (int p = 0; p < hitboxes.count; p++) {
+            float t = segmentPartT(hitboxes.parts[p], local, d);
+            if (t < b.t[i]) { b.t[i] = t; b.target[i] = j; b.part[i] = p; }
+        }
+    }
+}
+
+void hitTestScalar(HitBatch& b, const Vec3* targets, int targetCount) {
+    for (int i = 0; i < b.count; i++) hitTestSegment(b, i, targets, 0, targetCount);
+}
+
+#ifdef MATH_SSE
+inline __m128 sseSelect(__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+inline __m128 sseClamp01(__m128 v) { return _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f)); }
+
+// segmentCapsuleDist2() <= r^2 for four segments, relative to the capsule base
+inline int capsuleMask4(__m128 rx, __m128 ry, __m128 rz, __m128 dx, __m128 dy, __m128 dz, float height, float radius) {
+    const __m128 h = _mm_set1_ps(height), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+    __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    __m128 e = _mm_set1_ps(height * height);
+    __m128 b = _mm_mul_ps(dy, h);
+    __m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, rx), _mm_mul_ps(dy, ry)), _mm_mul_ps(dz, rz));
+    __m128 f = _mm_mul_ps(ry, h);
+    __m128 denom = _mm_sub_ps(_mm_mul_ps(a, e), _mm_mul_ps(b, b));
+    __m128 s = sseClamp01(_mm_div_ps(_mm_sub_ps(_mm_mul_ps(b, f), _mm_mul_ps(c, e)), denom));
+    s = _mm_and_ps(_mm_cmpgt_ps(denom, _mm_set1_ps(1e-12f)), s);
+    __m128 t = _mm_div_ps(_mm_add_ps(_mm_mul_ps(b, s), f), e);
+    __m128 below = _mm_cmplt_ps(t, zero), above = _mm_cmpgt_ps(t, one);
+    s = sseSelect(below, sseClamp01(_mm_div_ps(_mm_sub_ps(zero, c), a)), s);
+    s = sseSelect(above, sseClamp01(_mm_div_ps(_mm_sub_ps(b, c), a)), s);
+    t = sseClamp01(t);
+    __m128 px = _mm_add_ps(rx, _mm_mul_ps(dx, s));
+    __m128 py = _mm_sub_ps(_mm_add_ps(ry, _mm_mul_ps(dy, s)), _mm_mul_ps(h, t));
+    __m128 pz = _mm_add_ps(rz, _mm_mul_ps(dz, s));
+    __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz));
+    return _mm_movemask_ps(_mm_cmple_ps(dist2, _mm_set1_ps(radius * radius)));
+}
+
+// segmentPartT() for four segments
+inline __m128 partT4(const HitPart& h, __m128 ox, __m128 oy, __m128 oz, __m128 dx, __m128 dy, __m128 dz) {
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), miss = _mm_set1_ps(HIT_MISS);
+    if (h.shape == SHAPE_SPHERE) {
+        __m128 rx = _mm_sub_ps(ox, _mm_set1_ps(h.center.x)), ry = _mm_sub_ps(oy, _mm_set1_ps(h.center.y)), rz = _mm_sub_ps(oz, _mm_set1_ps(h.center.z));
+        __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, dx), _mm_mul_ps(ry, dy)), _mm_mul_ps(rz, dz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_mul_ps(rz, rz)), _mm_set1_ps(h.radius * h.radius));
+        __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(a, c));
+        __m128 t = _mm_div_ps(_mm_sub_ps(_mm_sub_ps(zero, b), _mm_sqrt_ps(_mm_max_ps(disc, zero))), a);
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(disc, zero), _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmple_ps(t, one)));
+        __m128 inside = _mm_cmple_ps(c, zero);
+        return sseSelect(inside, zero, sseSelect(hit, t, miss));
+    }
+    __m128 enter = zero, exit = one;
+    for (int i = 0; i < 3; i++) {
+        const float* row = h.rows[i];
+        __m128 r0 = _mm_set1_ps(row[0]), r1 = _mm_set1_ps(row[1]), r2 = _mm_set1_ps(row[2]);
+        __m128 lo = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, ox), _mm_mul_ps(r1, oy)), _mm_mul_ps(r2, oz)), _mm_set1_ps(row[3]));
+        __m128 ld = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, dx), _mm_mul_ps(r1, dy)), _mm_mul_ps(r2, dz));
+        __m128 t1 = _mm_div_ps(_mm_sub_ps(_mm_set1_ps(-1.0f), lo), ld), t2 = _mm_div_ps(_mm_sub_ps(one, lo), ld);
+        enter = _mm_max_ps(enter, _mm_min_ps(t1, t2));
+        exit = _mm_min_ps(exit, _mm_max_ps(t1, t2));
+    }
+    return sseSelect(_mm_cmple_ps(enter, exit), enter, miss);
+}
+#endif
+
+// Fills b.t/target/part. Without SSE this is hitTestScalar().
+void hitTestBatch(HitBatch& b, const Vec3* targets, int targetCount) {
+    hitStats.segments = b.count;
+    hitStats.pairs = b.count * targetCount;
+    hitStats.candidates = hitStats.hits = 0;
+#ifdef MATH_SSE
+    // Pad to whole lanes with segments far from everything
+    int padded = (b.count + 3) & ~3;
+    for (int i = b.count; i < padded; i++) {
+        b.x0[i] = b.y0[i] = b.z0[i] = 1e6f;
+        b.dx[i] = 1.0f; b.dy[i] = b.dz[i] = 0.0f;
+    }
+    for (int i = 0; i < b.count; i++) { b.t[i] = HIT_MISS; b.target[i] = -1; b.part[i] = -1; }
+
+    HitCandidates& c = hitCandidates;
+    const Vec3 base = hitboxes.capsuleBase;
+    for (int j = 0; j < targetCount; j++) {
+        const Vec3 p = targets[j];
+        const __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+        const __m128 bx = _mm_set1_ps(p.x + base.x), by = _mm_set1_ps(p.y + base.y), bz = _mm_set1_ps(p.z + base.z);
+        c.count = 0;
+        for (int i = 0; i < padded; i += 4) {
+            __m128 ox = _mm_load_ps(b.x0 + i), oy = _mm_load_ps(b.y0 + i), oz = _mm_load_ps(b.z0 + i);
+            __m128 dx = _mm_load_ps(b.dx + i), dy = _mm_load_ps(b.dy + i), dz = _mm_load_ps(b.dz + i);
+            int mask = capsuleMask4(_mm_sub_ps(ox, bx), _mm_sub_ps(oy, by), _mm_sub_ps(oz, bz), dx, dy, dz,
+                hitboxes.capsuleHeight, hitboxes.capsuleRadius);
+            if (!mask) continue;
+            alignas(16) float lx[4], ly[4], lz[4];
+            _mm_store_ps(lx, _mm_sub_ps(ox, px)); _mm_store_ps(ly, _mm_sub_ps(oy, py)); _mm_store_ps(lz, _mm_sub_ps(oz, pz));
+            for (int k = 0; k < 4; k++) {
+                if (!(mask & (1 << k))) continue;
+                int n = c.count++;
+                c.index[n] = i + k;
+                c.ox[n] = lx[k]; c.oy[n] = ly[k]; c.oz[n] = lz[k];
+                c.dx[n] = b.dx[i + k]; c.dy[n] = b.dy[i + k]; c.dz[n] = b.dz[i + k];
+            }
+        }
+        if (c.count == 0) continue;
+        hitStats.candidates += c.count;
+        int lanes = (c.count + 3) & ~3;
+        for (int n = c.count; n < lanes; n++) {   // repeat the last one
+            c.ox[n] = c.ox[n - 1]; c.oy[n] = c.oy[n - 1]; c.oz[n] = c.oz[n - 1];
+            c.dx[n] = c.dx[n - 1]; c.dy[n] = c.dy[n - 1]; c.dz[n] = c.dz[n - 1];
+        }
+
+        for (int n = 0; n < lanes; n += 4) {
+            __m128 ox = _mm_load_ps(c.ox + n), oy = _mm_load_ps(c.oy + n), oz = _mm_load_ps(c.oz + n);
+            __m128 dx = _mm_load_ps(c.dx + n), dy = _mm_load_ps(c.dy + n), dz = _mm_load_ps(c.dz + n);
+            __m128 best = _mm_set1_ps(HIT_MISS), part = _mm_set1_ps(-1.0f);
+            for (int k = 0; k < hitboxes.count; k++) {
+                __m128 t = partT4(hitboxes.parts[k], ox, oy, oz, dx, dy, dz);
+                __m128 nearer = _mm_cmplt_ps(t, best);
+                best = _mm_min_ps(t, best);
+                part = sseSelect(nearer, _mm_set1_ps((float)k), part);
+            }
+            _mm_store_ps(c.t + n, best);
+            _mm_store_si128((__m128i*)(c.part + n), _mm_cvttps_epi32(part));
+        }
+        for (int n = 0; n < c.count; n++) {
+            int i = c.index[n];
+            if (c.t[n] < b.t[i]) { b.t[i] = c.t[n]; b.target[i] = j; b.part[i] = c.part[n]; }
+        }
+    }
+#else
+    hitTestScalar(b, targets, targetCount);
+#endif
+    for (int i = 0; i < b.count; i++) hitStats.hits += b.target[i] >= 0;
+}
+
+// Returns the segment's slot, or -1 when the batch is full
+int hitAddSegment(HitBatch& b, const Vec3& from, const Vec3& to) {
+    if (b.count >= HIT_MAX_SEGMENTS) return -1;
+    int i = b.count++;
+    b.x0[i] = from.x; b.y0[i] = from.y; b.z0[i] = from.z;
+    b.dx[i] = to.x - from.x; b.dy[i] = to.y - from.y; b.dz[i] = to.z - from.z;
+    return i;
+}
+
+// --bench-hits N: N bullet segments per tick against a crowd of enemies,
+// batched against the scalar reference, without opening a window.
+int benchHits(int segments) {
+    const int TARGETS = 64, TICKS = 200;
+    if (segments < 1) segments = 1;
+    if (segments > HIT_MAX_SEGMENTS) segments = HIT_MAX_SEGMENTS;
+    initModels();
+    initHitboxes();
+
+    unsigned seed = 12345u;
+    auto rnd = [&seed]() { seed = seed * 1103515245u + 12345u; return ((seed >> 8) & 0xFFFF) / 65535.0f; };
+    Vec3 targets[TARGETS];
+    for (int i = 0; i < TARGETS; i++) targets[i] = { (i % 8) * 3.0f, rnd() * 0.5f, (i / 8) * 3.0f };
+    static HitBatch reference;
+    for (int i = 0; i < segments; i++) {
+        Vec3 from = { rnd() * 24.0f - 1.5f, rnd() * 2.5f - 0.2f, rnd() * 24.0f - 1.5f };
+        Vec3 dir = { rnd() - 0.5f, (rnd() - 0.5f) * 0.3f, rnd() - 0.5f };
+        vecNormalize(dir);
+        hitAddSegment(hitBatch, from, vecAdd(from, vecScale(dir, 15.0f / 60.0f)));
+    }
+    reference = hitBatch;
+
+    double start = preciseSeconds();
+    for (int k = 0; k < TICKS; k++) hitTestBatch(hitBatch, targets, TARGETS);
+    double batchedMs = (preciseSeconds() - start) * 1000.0 / TICKS;
+    start = preciseSeconds();
+    for (int k = 0; k < TICKS; k++) hitTestScalar(reference, targets, TARGETS);
+    double scalarMs = (preciseSeconds() - start) * 1000.0 / TICKS;
+
+    int mismatches = 0, byPart[HIT_MAX_PARTS] = {};
+    for (int i = 0; i < segments; i++) {
+        if (hitBatch.target[i] != reference.target[i] || hitBatch.part[i] != reference.part[i] ||
+            fabsf(hitBatch.t[i] - reference.t[i]) > 1e-4f) mismatches++;
+        if (hitBatch.part[i] >= 0) byPart[hitBatch.part[i]]++;
+    }
+    printf("Hit bench: %d segments x %d enemies, %d parts each\n", segments, TARGETS, hitboxes.count);
+    printf("  batched %.3f ms/tick (%.1f ns/segment), scalar %.3f ms/tick, %.1fx\n",
+        batchedMs, batchedMs * 1e6 / segments, scalarMs, scalarMs / batchedMs);
+    printf("  %d capsule pairs, %d passed (%.2f%%), %d hits:", hitStats.pairs, hitStats.candidates,
+        100.0 * hitStats.candidates / hitStats.pairs, hitStats.hits);
+    for (int p = 0; p < hitboxes.count; p++) printf(" %s %d", hitboxes.parts[p].name, byPart[p]);
+    printf("\n  %d mismatches against the scalar reference\n", mismatches);
+
+    // A shot whose nearest enemy went down earlier in the tick is retested
+    // against the rest: it must find what the scalar test finds with that
+    // enemy gone, never the downed one and never anything nearer
+    static bool down[TARGETS];
+    Vec3 moved[TARGETS];
+    int retests = 0, retestMismatches = 0;
+    for (int i = 0; i < segments && retests < 256; i++) {
+        int j = hitBatch.target[i];
+        if (j < 0) continue;
+        float t = hitBatch.t[i];
+        down[j] = true;
+        hitTestSegment(hitBatch, i, targets, down, TARGETS);
+        down[j] = false;
+        memcpy(moved, targets, sizeof(moved));
+        moved[j] = { 1e6f, 0.0f, 1e6f };
+        reference.count = i + 1;
+        hitTestSegment(reference, i, moved, 0, TARGETS);
+        if (hitBatch.target[i] == j || hitBatch.t[i] < t || hitBatch.target[i] != reference.target[i] ||
+            hitBatch.part[i] != reference.part[i] || fabsf(hitBatch.t[i] - reference.t[i]) > 1e-4f) retestMismatches++;
+        retests++;
+    }
+    // And one shot along the first row, through the first enemy into the second
+    int slot = segments < HIT_MAX_SEGMENTS ? segments : segments - 1;
+    hitBatch.count = slot;
+    hitAddSegment(hitBatch, { -1.0f, targets[0].y + 1.0f, 0.0f }, { 4.0f, targets[0].y + 1.0f, 0.0f });
+    hitTestSegment(hitBatch, slot, targets, down, TARGETS);
+    if (hitBatch.target[slot] != 0) retestMismatches++;
+    down[0] = true;
+    hitTestSegment(hitBatch, slot, targets, down, TARGETS);
+    down[0] = false;
+    if (hitBatch.target[slot] != 1) retestMismatches++;
+    printf("  %d retests past a downed enemy, %d mismatches\n", retests + 1, retestMismatches);
+    return mismatches || retestMismatches ? 1 : 0;
+}
+// --------------------------------------------------------------
+
+// ---------------------- SNAPSHOTS -------------------------
+// The whole mutable game state as one plain struct: camera, player, every
+// enemy, bullet and particle, and the gameplay RNG. A snapshot is taken
+// every few ticks into a fixed ring, so nothing is allocated while playing,
+// and restoring one rebuilds the dynamic entities in place.
+//  - F6 rewinds to the previous snapshot (again to go further back)
+//  - F7 saves the current state to the checkpoint file, --resume loads it
+//  - F8, or Enter after game over, restarts from the state at startup
+// Time stamps inside the state (when an enemy last saw the player) are
+// shifted by the time that passed since capture.
+// A replay after a rewind matches the original only with --fixed-step and
+// the same input: every tick then advances the game clock by the same dt,
+// the clock itself is rewound with the tick count, and deferred changes are
+// applied in system order whatever the thread timing. With the default
+// wall-clock dt, a replay takes the same decisions on different timings.
+#define SNAPSHOT_RING 64
+#define SNAPSHOT_MAGIC "FPSSNAP1"
+
+struct SnapshotEnemy {
+    Vec3 pos, dir;
+    EnemyCombat combat;
+    EnemyMemory memory;
+    float respawn;        // seconds until back, < 0 while alive
+};
+struct SnapshotBullet { Vec3 pos, dir; float life; int owner; };
+struct SnapshotParticle { Vec3 pos, vel; float life; };
+
+struct Snapshot {
+    uint32_t tick;
+    float time;           // nowSeconds() at capture
+    unsigned rng;
+    Vec3 camPos;
+    float yaw, pitch, verticalVelocity;
+    int score, bulletsLeft, playerHealth;
+    float reloadTimer, damageFlash;
+    bool onGround, reloading, gameOver;
+    int enemyCount, bulletCount, particleCount;
+    SnapshotEnemy enemies[MAX_ENEMIES];
+    SnapshotBullet bullets[MAX_BULLETS];
+    SnapshotParticle particles[MAX_PARTICLES];
+};
+
+struct Snapshots {
+    Snapshot ring[SNAPSHOT_RING];
+    Snapshot start;       // right after initialization, for restarts
+    int newest = -1, count = 0;
+    int every = 30;       // ticks between captures
+    uint32_t tick = 0;
+    char checkpoint[256] = "checkpoint.snap";
+    float fixedDt = 0.0f;     // --fixed-step: seconds per tick, 0 for wall-clock dt
+    float captureUs = 0.0f, restoreUs = 0.0f;   // last ones
+};
+Snapshots snapshots;
+
+// Game clock the systems see; under a fixed step it is derived from the tick
+float gameSeconds() { return snapshots.fixedDt > 0.0f ? snapshots.tick * snapshots.fixedDt : nowSeconds(); }
+// --------------------------------------------------------------
+
+// ---------------------- RENDER QUEUE -------------------------
+// Draws are not issued directly: submit*() functions record commands into
+// per-frame arena memory, each with a 64-bit sort key
+//   pass (4) | blend (2) | texture (16) | mesh (16) | submission order (26)
+// and executeCommands() replays them sorted, routing every enable/disable,
+// texture bind, color and projection through a small state cache that drops
+// calls which would not change anything. Fog, light color, color material,
+// blend function and line width never change and are set once at startup.
+#define FRAME_ARENA_BYTES (512 * 1024)
+#define MAX_RENDER_COMMANDS 4096
+
+struct FrameArena {
+    alignas(16) unsigned char memory[FRAME_ARENA_BYTES];
+    size_t used = 0, peak = 0;
+};
+FrameArena frameArena;
+
+void* arenaAlloc(size_t bytes) {
+    size_t offset = (frameArena.used + 15) & ~(size_t)15;
+    if (offset + bytes > FRAME_ARENA_BYTES) return 0;
+    frameArena.used = offset + bytes;
+    if (frameArena.used > frameArena.peak) frameArena.peak = frameArena.used;
+    return frameArena.memory + offset;
+}
+
+enum RenderPass {
+    PASS_SKY, PASS_OPAQUE, PASS_TRANSLUCENT,  // scene target (dynamic resolution)
+    PASS_OVERLAY, PASS_HUD, PASS_GUN          // native resolution
+};
+enum BlendMode { BLEND_NONE, BLEND_ALPHA };
+enum MeshId { MESH_SKYDOME = 1, MESH_TERRAIN, MESH_RAILS, MESH_SPHERE, MESH_CUBE, MESH_CONE, MESH_QUAD, MESH_HUD, MESH_BAKED };
+enum StateCaps { CAP_LIGHTING = 1, CAP_DEPTH = 2, CAP_FOG = 4, CAP_TEXTURE = 8, CAP_BLEND = 16 };
+enum Projection { PROJ_NONE, PROJ_SCENE, PROJ_UNIT, PROJ_WINDOW };
+
+struct RenderCommand;
+typedef void (*DrawFn)(const RenderCommand& cmd);
+
+struct RenderCommand {
+    unsigned caps;
+    GLuint texture;
+    const Mat4* modelView;   // points at transformScene() output or static data
+    float color[4];
+    PartShape shape;         // for MESH_SPHERE/CUBE/CONE
+    DrawFn draw;             // everything else
+    int part;                // piece of a mesh drawn in pieces (terrain sector)
+};
+
+struct SortEntry {
+    uint64_t key;
+    RenderCommand* cmd;
+    bool operator<(const SortEntry& o) const { return key < o.key; }
+};
+
+struct RenderQueue {
+    SortEntry* entries = 0;
+    int count = 0, dropped = 0;
+};
+RenderQueue renderQueue;
+
+// What the GL currently has, as far as the queue knows
+struct GLStateCache {
+    bool valid = false;
+    unsigned caps = 0;
+    GLuint texture = 0;
+    bool colorValid = false;
+    float color[4];
+    int projection = PROJ_NONE;
+    const Mat4* modelView = 0;
+};
+GLStateCache glState;
+
+struct RenderStats {
+    int commands = 0, stateChanges = 0, redundantDropped = 0;
+    int lastCommands = 0, lastStateChanges = 0, lastRedundantDropped = 0, lastDropped = 0;
+    size_t lastArenaBytes = 0;
+};
+RenderStats renderStats;
+
+void initRenderState() {
+    GLfloat fogColor[4] = { 0.5f, 0.7f, 1.0f, 1.0f };
+    glFogi(GL_FOG_MODE, GL_EXP2);
+    glFogfv(GL_FOG_COLOR, fogColor);
+    glFogf(GL_FOG_DENSITY, 0.005f);
+    glHint(GL_FOG_HINT, GL_NICEST);
+
+    float lightcol[4] = { 0.9f, 0.85f, 0.75f, 1 };
+    glEnable(GL_LIGHT0);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, lightcol);
+    glEnable(GL_COLOR_MATERIAL);
+    glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glLineWidth(2.0f);
+}
+
+// Something outside the queue touched GL state (scene resolve, reshape)
+void renderStateInvalidate() {
+    glState.valid = false;
+    glState.texture = 0;
+    glState.colorValid = false;
+    glState.projection = PROJ_NONE;
+    glState.modelView = 0;
+}
+
+void renderBeginFrame() {
+    renderStats.lastCommands = renderStats.commands;
+    renderStats.lastStateChanges = renderStats.stateChanges;
+    renderStats.lastRedundantDropped = renderStats.redundantDropped;
+    renderStats.lastDropped = renderQueue.dropped;
+    renderStats.lastArenaBytes = frameArena.used;
+    renderStats.commands = renderStats.stateChanges = renderStats.redundantDropped = 0;
+
+    // Matrix contents change every frame even where the pointers don't
+    glState.modelView = 0;
+    glState.projection = PROJ_NONE;
+
+    frameArena.used = 0;
+    renderQueue.entries = (SortEntry*)arenaAlloc(sizeof(SortEntry) * MAX_RENDER_COMMANDS);
+    renderQueue.count = 0;
+    renderQueue.dropped = 0;
+}
+
+// Returns a command to fill in, or null when the frame's budget is used up.
+RenderCommand* submit(int pass, int blend, GLuint texture, int mesh, unsigned caps) {
+    if (renderQueue.count >= MAX_RENDER_COMMANDS) { renderQueue.dropped++; return 0; }
+    RenderCommand* cmd = (RenderCommand*)arenaAlloc(sizeof(RenderCommand));
+    if (!cmd) { renderQueue.dropped++; return 0; }
+    if (blend != BLEND_NONE) caps |= CAP_BLEND;
+    if (texture) caps |= CAP_TEXTURE;
+    cmd->caps = caps;
+    cmd->texture = texture;
+    cmd->modelView = 0;
+    cmd->color[0] = cmd->color[1] = cmd->color[2] = cmd->color[3] = 1.0f;
+    cmd->draw = 0;
+    cmd->part = 0;
+    SortEntry& e = renderQueue.entries[renderQueue.count];
+    e.key = ((uint64_t)pass << 60) | ((uint64_t)blend << 58) | ((uint64_t)(texture & 0xFFFF) << 42) |
+        ((uint64_t)(mesh & 0xFFFF) << 26) | (uint64_t)(renderQueue.count & 0x3FFFFFF);
+    e.cmd = cmd;
+    renderQueue.count++;
+    return cmd;
+}
+
+void setColor(RenderCommand* cmd, float r, float g, float b, float a = 1.0f) {
+    cmd->color[0] = r; cmd->color[1] = g; cmd->color[2] = b; cmd->color[3] = a;
+}
+
+void applyCaps(unsigned caps) {
+    static const GLenum capEnums[5] = { GL_LIGHTING, GL_DEPTH_TEST, GL_FOG, GL_TEXTURE_2D, GL_BLEND };
+    if (glState.valid && glState.caps == caps) { renderStats.redundantDropped++; return; }
+    for (int i = 0; i < 5; i++) {
+        unsigned bit = 1u << i;
+        if (glState.valid && (glState.caps & bit) == (caps & bit)) continue;
+        if (caps & bit) glEnable(capEnums[i]); else glDisable(capEnums[i]);
+        renderStats.stateChanges++;
+    }
+    glState.caps = caps;
+    glState.valid = true;
+}
+
+void applyTexture(GLuint texture) {
+    if (!texture) return; // unbound textures are harmless while GL_TEXTURE_2D is off
+    if (glState.texture == texture) { renderStats.redundantDropped++; return; }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glState.texture = texture;
+    renderStats.stateChanges++;
+}
+
+void applyColor(const float* c) {
+    if (glState.colorValid && !memcmp(glState.color, c, sizeof(glState.color))) { renderStats.redundantDropped++; return; }
+    glColor4fv(c);
+    memcpy(glState.color, c, sizeof(glState.color));
+    glState.colorValid = true;
+    renderStats.stateChanges++;
+}
+
+void applyModelView(const Mat4* m) {
+    if (glState.modelView == m) { renderStats.redundantDropped++; return; }
+    glLoadMatrixf(m->m);
+    glState.modelView = m;
+    renderStats.stateChanges++;
+}
+
+void applyProjection(int projection) {
+    if (glState.projection == projection) { renderStats.redundantDropped++; return; }
+    static const Mat4 unitOrtho = mat4Ortho2D(0, 1, 0, 1);
+    glMatrixMode(GL_PROJECTION);
+    if (projection == PROJ_SCENE) glLoadMatrixf(projMatrix.m);
+    else if (projection == PROJ_UNIT) glLoadMatrixf(unitOrtho.m);
+    else { Mat4 windowOrtho = mat4Ortho2D(0, (float)WIN_W, 0, (float)WIN_H); glLoadMatrixf(windowOrtho.m); }
+    glMatrixMode(GL_MODELVIEW);
+    glState.projection = projection;
+    renderStats.stateChanges++;
+}
+
+int passProjection(int pass) {
+    if (pass == PASS_OVERLAY) return PROJ_UNIT;
+    if (pass == PASS_HUD) return PROJ_WINDOW;
+    return PROJ_SCENE;
+}
+
+// Sorts once per frame, then replays passes [firstPass, lastPass].
+void executeCommands(int firstPass, int lastPass) {
+    static const Mat4 identity = mat4Identity();
+    if (firstPass == PASS_SKY) std::sort(renderQueue.entries, renderQueue.entries + renderQueue.count);
+
+    glMatrixMode(GL_MODELVIEW);
+    int currentPass = -1;
+    for (int i = 0; i < renderQueue.count; i++) {
+        int pass = (int)(renderQueue.entries[i].key >> 60);
+        if (pass < firstPass || pass > lastPass) continue;
+        const RenderCommand& cmd = *renderQueue.entries[i].cmd;
+
+        if (pass != currentPass) {
+            currentPass = pass;
+            applyProjection(passProjection(pass));
+            if (pass == PASS_SKY) {
+                // Directional sun, specified in eye space through the view matrix
+                Vec3 sun = sunOffset();
+                float lightpos[4] = { sun.x, sun.y, sun.z, 0 };
+                applyModelView(&viewMatrix);
+                glLightfv(GL_LIGHT0, GL_POSITION, lightpos);
+            }
+        }
+
+        applyCaps(cmd.caps);
+        applyTexture(cmd.texture);
+        applyColor(cmd.color);
+        applyModelView(cmd.modelView ? cmd.modelView : &identity);
+        if (cmd.draw) {
+            cmd.draw(cmd);
+            glState.colorValid = false; // custom draws set their own colors
+        }
+        else drawShape(cmd.shape);
+        renderStats.commands++;
+    }
+}
+// --------------------------------------------------------------
+
+// Builds every modelview matrix needed this frame (call after updateViewMatrix()).
+void transformScene() {
+    forEachChunk(Q_PROP, [](Chunk* c) {
+        mat4MulBatch(viewMatrix, column<Mat4>(c, COMP_WORLD), column<Mat4>(c, COMP_MODELVIEW), c->count);
+    });
+    forEachChunk(Q_ENEMY, [](Chunk* c) {
+        const Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        EnemyPartMatrices* parts = column<EnemyPartMatrices>(c, COMP_PART_MODELVIEWS);
+        for (int i = 0; i < c->count; i++)
+            mat4MulBatch(mat4PostTranslate(viewMatrix, pos[i].x, pos[i].y, pos[i].z), enemyPartLocal, parts[i].parts, ENEMY_PARTS);
+    });
+    // Bullets and particles
+    forEachChunk(BIT(COMP_POSITION) | BIT(COMP_MODELVIEW), [](Chunk* c) {
+        const Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        Mat4* mv = column<Mat4>(c, COMP_MODELVIEW);
+        for (int i = 0; i < c->count; i++) mv[i] = mat4PostTranslate(viewMatrix, pos[i].x, pos[i].y, pos[i].z);
+    });
+
+    Vec3 sun = sunOffset();
+    skyModelView = mat4PostTranslate(viewMatrix, camPos.x, 0, camPos.z);
+    sunModelView = mat4PostTranslate(skyModelView, sun.x, sun.y, sun.z);
+}
+
+int meshFor(const PartShape& s) { return s.shape == SHAPE_SPHERE ? MESH_SPHERE : (s.shape == SHAPE_CUBE ? MESH_CUBE : MESH_CONE); }
+
+// Lit, fogged, depth-tested geometry
+const unsigned SCENE_LIT = CAP_LIGHTING | CAP_DEPTH | CAP_FOG;
+const unsigned SCENE_UNLIT = CAP_DEPTH | CAP_FOG;
+
+// Draw helpers
+void submitGun() {
+    for (int i = 0; i < GUN_PARTS; i++) {
+        RenderCommand* cmd = submit(PASS_GUN, BLEND_NONE, 0, meshFor(gunPartShape[i]), 0);
+        if (!cmd) return;
+        setColor(cmd, gunPartShape[i].color.x, gunPartShape[i].color.y, gunPartShape[i].color.z);
+        cmd->modelView = &gunPartView[i];
+        cmd->shape = gunPartShape[i];
+    }
+
+    // Muzzle flash
+    static float lastFireTime = -10.0f;
+    if (justFired) {
+        lastFireTime = lastTime;
+        justFired = false;
+    }
+    if (lastTime - lastFireTime < 0.08f) {
+        float alpha = 1.0f - (lastTime - lastFireTime) / 0.08f;
+        RenderCommand* cmd = submit(PASS_GUN, BLEND_ALPHA, 0, MESH_SPHERE, 0);
+        if (!cmd) return;
+        setColor(cmd, 1.0f, 0.7f, 0.2f, alpha * 0.9f);
+        cmd->modelView = &gunMuzzleView;
+        float size = 0.1f + 0.2f * sinf(lastTime * 200.0f);
+        cmd->shape = makeShape(SHAPE_SPHERE, size, 0, 6, 6, { 1.0f, 0.7f, 0.2f });
+    }
+}
+
+// Draw
+void drawSkydomeMesh(const RenderCommand& cmd) {
+    (void)cmd;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(SkyVertex), &assets.skydome[0].u);
+    glVertexPointer(3, GL_FLOAT, sizeof(SkyVertex), &assets.skydome[0].x);
+    for (int i = 0; i < SKYDOME_SEGMENTS; ++i) glDrawArrays(GL_TRIANGLE_STRIP, i * SKYDOME_STRIP, SKYDOME_STRIP);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void submitSkydome() {
+    RenderCommand* cmd = submit(PASS_SKY, BLEND_NONE, skyTex, MESH_SKYDOME, SCENE_UNLIT);
+    if (!cmd) return;
+    cmd->modelView = &skyModelView;
+    cmd->draw = drawSkydomeMesh;
+
+    cmd = submit(PASS_SKY, BLEND_NONE, 0, MESH_SPHERE, SCENE_UNLIT);
+    if (!cmd) return;
+    setColor(cmd, 1, 0.95f, 0.7f);
+    cmd->modelView = &sunModelView;
+    cmd->shape = makeShape(SHAPE_SPHERE, 6.0f, 0, 16, 16, { 1, 0.95f, 0.7f });
+}
 
-    glColor3f(0.4f, 0.25f, 0.1f);
-    glPushMatrix(); glTranslatef(15.0f, terrainHeight(15, 5) + 1.0f, 5.0f); glRotatef(-90, 1, 0, 0); glutSolidCone(0.4f, 3.0f, 8, 8); glPopMatrix();
-    glColor3f(0.1f, 0.5f, 0.1f);
-    glPushMatrix(); glTranslatef(15.0f, terrainHeight(15, 5) + 3.0f, 5.0f); glutSolidCone(1.8f, 3.5f, 8, 8); glPopMatrix();
+// Static geometry carries baked per-vertex colors and is drawn unlit
+void drawTerrainSector(const RenderCommand& cmd) {
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, assets.terrain->verts);
+    glColorPointer(3, GL_UNSIGNED_BYTE, 0, baked.terrainColors);
+    glDrawElements(GL_TRIANGLES, SECTOR_CELLS * SECTOR_CELLS * 6, GL_UNSIGNED_SHORT, assets.terrain->sectorIndices[cmd.part]);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-    // Crates
-    glColor3f(0.7f, 0.3f, 0.2f);
-    glPushMatrix(); glTranslatef(2, terrainHeight(2, -2) + 0.5f, -2); glutSolidCube(1); glPopMatrix();
-    glPushMatrix(); glTranslatef(-3, terrainHeight(-3, 4) + 0.5f, 4); glutSolidCube(1); glPopMatrix();
+void drawBakedProp(const RenderCommand& cmd) {
+    const BakedInstance& inst = baked.instances[cmd.part];
+    const StaticMesh& mesh = baked.meshes[inst.mesh];
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, baked.meshPos + mesh.first);
+    glColorPointer(3, GL_UNSIGNED_BYTE, 0, (inst.layout ? baked.layoutColors : baked.propColors)[inst.firstColor]);
+    glDrawArrays(GL_TRIANGLES, 0, mesh.count);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-    // Fence
-    glColor3f(0.3f, 0.3f, 0.3f);
-    glLineWidth(2.0f);
+void submitFloor() {
+    for (int s = 0; s < TERRAIN_SECTORS * TERRAIN_SECTORS; s++) {
+        if (!occlusionVisible(terrainSectorBounds[s], OCCLUDEE_SECTOR)) continue;
+        RenderCommand* cmd = submit(PASS_OPAQUE, BLEND_NONE, 0, MESH_TERRAIN, SCENE_UNLIT);
+        if (!cmd) return;
+        cmd->modelView = &viewMatrix;
+        cmd->draw = drawTerrainSector;
+        cmd->part = s;
+    }
+}
+
+void drawFenceRails(const RenderCommand& cmd) {
+    (void)cmd;
     glBegin(GL_LINES);
     for (float x = -15; x <= 15; x += 0.5f) {
         float h = terrainHeight(x, -12);
@@ -364,112 +3561,177 @@ void drawEnvironment() {
         glVertex3f(x, h + 1.5f, -12);
     }
     glEnd();
-    glColor3f(0.2f, 0.15f, 0.1f);
-    for (float x = -15; x <= 15; x += 5.0f) {
-        float h = terrainHeight(x, -12);
-        glPushMatrix();
-        glTranslatef(x, h + 0.8f, -12);
-        glScalef(0.3f, 1.2f, 0.3f);
-        glutSolidCube(1);
-        glPopMatrix();
-    }
-
-    // Building
-    glColor3f(0.55f, 0.55f, 0.55f);
-    glPushMatrix(); glTranslatef(12.0f, terrainHeight(12, -8) + 4.0f, -8.0f); glScalef(6.0f, 8.0f, 6.0f); glutSolidCube(1); glPopMatrix();
-    glColor3f(0.2f, 0.15f, 0.1f);
-    glPushMatrix(); glTranslatef(12.0f, terrainHeight(12, -8) + 1.0f, -5.0f); glScalef(1.2f, 2.0f, 0.1f); glutSolidCube(1); glPopMatrix();
 }
 
-void drawEnemy(Enemy& e) {
-    if (e.deathTimer > 0.0f) return; // ✅ skip dead enemies
+void submitEnvironment() {
+    // Rocks, trees, crates, fence posts, building
+    forEachChunk(Q_PROP, [](Chunk* c) {
+        const PartShape* shape = column<PartShape>(c, COMP_SHAPE);
+        const Bounds* bounds = column<Bounds>(c, COMP_BOUNDS);
+        const int* instance = column<int>(c, COMP_BAKED);
+        const Mat4* mv = column<Mat4>(c, COMP_MODELVIEW);
+        for (int i = 0; i < c->count; ++i) {
+            if (!occlusionVisible(bounds[i], OCCLUDEE_PROP)) continue;
+            if (instance[i] >= 0) {
+                RenderCommand* cmd = submit(PASS_OPAQUE, BLEND_NONE, 0, MESH_BAKED, SCENE_UNLIT);
+                if (!cmd) return;
+                cmd->modelView = &mv[i];
+                cmd->draw = drawBakedProp;
+                cmd->part = instance[i];
+                continue;
+            }
+            RenderCommand* cmd = submit(PASS_OPAQUE, BLEND_NONE, 0, meshFor(shape[i]), SCENE_LIT);
+            if (!cmd) return;
+            setColor(cmd, shape[i].color.x, shape[i].color.y, shape[i].color.z);
+            cmd->modelView = &mv[i];
+            cmd->shape = shape[i];
+        }
+    });
 
-    glPushMatrix();
-    glTranslatef(e.pos.x, e.pos.y, e.pos.z);
+    RenderCommand* cmd = submit(PASS_OPAQUE, BLEND_NONE, 0, MESH_RAILS, SCENE_LIT);
+    if (!cmd) return;
+    setColor(cmd, 0.3f, 0.3f, 0.3f);
+    cmd->modelView = &viewMatrix;
+    cmd->draw = drawFenceRails;
+}
 
-    if (e.flashTimer > 0.0f) {
-        float f = (sinf(e.flashTimer * 50.0f) + 1.0f) * 0.5f;
-        glColor3f(1.0f, f * 0.5f, f * 0.5f);
+void submitEnemy(const EnemyCombat& e, const Mat4* partModelView) {
+    for (int i = 0; i < ENEMY_PARTS; i++) {
+        const PartShape& s = enemyPartShape[i];
+        RenderCommand* cmd = submit(PASS_OPAQUE, BLEND_NONE, 0, meshFor(s), SCENE_LIT);
+        if (!cmd) return;
+        if (s.flashes && e.flashTimer > 0.0f) {
+            float f = (sinf(e.flashTimer * 50.0f) + 1.0f) * 0.5f;
+            setColor(cmd, 1.0f, f * 0.5f, f * 0.5f);
+        }
+        else {
+            setColor(cmd, s.color.x, s.color.y, s.color.z);
+        }
+        cmd->modelView = &partModelView[i];
+        cmd->shape = s;
     }
-    else {
-        glColor3f(0.8f, 0.3f, 0.3f);
-    }
-
-    // Head
-    glPushMatrix();
-    glTranslatef(0, 1.5f, 0);
-    glutSolidSphere(0.2f, 8, 8);
-    glPopMatrix();
-
-    // Body
-    glColor3f(0.2f, 0.2f, 0.6f);
-    glPushMatrix();
-    glTranslatef(0, 0.9f, 0);
-    glScalef(0.4f, 0.8f, 0.3f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
-
-    // Arms
-    glColor3f(0.8f, 0.3f, 0.3f);
-    glPushMatrix();
-    glTranslatef(0.3f, 1.1f, 0);
-    glScalef(0.2f, 0.6f, 0.2f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
-    glPushMatrix();
-    glTranslatef(-0.3f, 1.1f, 0);
-    glScalef(0.2f, 0.6f, 0.2f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
-
-    // Legs
-    glColor3f(0.1f, 0.1f, 0.4f);
-    glPushMatrix();
-    glTranslatef(0.15f, 0.3f, 0);
-    glScalef(0.2f, 0.6f, 0.2f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
-    glPushMatrix();
-    glTranslatef(-0.15f, 0.3f, 0);
-    glScalef(0.2f, 0.6f, 0.2f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
+}
 
-    // Gun
-    glColor3f(0.1f, 0.1f, 0.1f);
-    glPushMatrix();
-    glTranslatef(0.4f, 1.0f, 0);
-    glRotatef(-20, 0, 0, 1);
-    glScalef(0.05f, 0.3f, 0.05f);
-    glutSolidCube(1.0f);
-    glPopMatrix();
+void submitBullet(const BulletInfo& b, const Mat4& modelView) {
+    RenderCommand* cmd = submit(PASS_OPAQUE, BLEND_NONE, 0, MESH_SPHERE, SCENE_LIT);
+    if (!cmd) return;
+    setColor(cmd, b.owner == 0 ? 1.0f : 1.0f, b.owner == 0 ? 1.0f : 0.3f, b.owner == 0 ? 0.0f : 0.3f);
+    cmd->modelView = &modelView;
+    cmd->shape = makeShape(SHAPE_SPHERE, 0.05f, 0, 6, 6, { 1, 1, 1 });
+}
+
+void submitParticle(float life, const Mat4& modelView) {
+    RenderCommand* cmd = submit(PASS_TRANSLUCENT, BLEND_ALPHA, 0, MESH_SPHERE, SCENE_LIT);
+    if (!cmd) return;
+    setColor(cmd, 1.0f, 0.5f, 0.0f, life > 0.2f ? 1.0f : life * 5.0f);
+    cmd->modelView = &modelView;
+    cmd->shape = makeShape(SHAPE_SPHERE, 0.05f + life * 0.1f, 0, 4, 4, { 1.0f, 0.5f, 0.0f });
+}
+
+// Dead enemies live in another archetype and are simply not visited
+void submitEntities() {
+    forEachChunk(Q_ENEMY, [](Chunk* c) {
+        const Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        const EnemyCombat* combat = column<EnemyCombat>(c, COMP_ENEMY);
+        const EnemyPartMatrices* parts = column<EnemyPartMatrices>(c, COMP_PART_MODELVIEWS);
+        for (int i = 0; i < c->count; i++) {
+            Bounds b = { vecAdd(pos[i], ENEMY_BOX_MIN), vecAdd(pos[i], ENEMY_BOX_MAX) };
+            if (occlusionVisible(b, OCCLUDEE_ENEMY)) submitEnemy(combat[i], parts[i].parts);
+        }
+    });
+    forEachChunk(Q_BULLET, [](Chunk* c) {
+        const BulletInfo* info = column<BulletInfo>(c, COMP_BULLET);
+        const Mat4* mv = column<Mat4>(c, COMP_MODELVIEW);
+        for (int i = 0; i < c->count; i++) submitBullet(info[i], mv[i]);
+    });
+    forEachChunk(Q_PARTICLE, [](Chunk* c) {
+        const float* life = column<float>(c, COMP_LIFETIME);
+        const Mat4* mv = column<Mat4>(c, COMP_MODELVIEW);
+        for (int i = 0; i < c->count; i++) submitParticle(life[i], mv[i]);
+    });
+}
 
-    glPopMatrix();
+void drawScreenQuad(const RenderCommand& cmd) {
+    (void)cmd;
+    glBegin(GL_QUADS);
+    glVertex2f(0, 0); glVertex2f(1, 0); glVertex2f(1, 1); glVertex2f(0, 1);
+    glEnd();
+}
+
+void submitDamageFlash() {
+    RenderCommand* cmd = submit(PASS_OVERLAY, BLEND_ALPHA, 0, MESH_QUAD, 0);
+    if (!cmd) return;
+    setColor(cmd, 1.0f, 0.2f, 0.2f, damageFlash * 0.8f);
+    cmd->draw = drawScreenQuad;
 }
 
-void drawBullet(Bullet& b) {
-    glPushMatrix();
-    glTranslatef(b.pos.x, b.pos.y, b.pos.z);
-    glColor3f(b.owner == 0 ? 1.0f : 1.0f, b.owner == 0 ? 1.0f : 0.3f, b.owner == 0 ? 0.0f : 0.3f);
-    glutSolidSphere(0.05f, 6, 6);
-    glPopMatrix();
+void drawText(float x, float y, const char* text, void* font) {
+    glRasterPos2f(x, y);
+    for (const char* p = text; *p; ++p) glutBitmapCharacter(font, *p);
 }
 
-void drawParticle(Particle& p) {
-    glPushMatrix();
-    glTranslatef(p.pos.x, p.pos.y, p.pos.z);
-    glColor4f(1.0f, 0.5f, 0.0f, p.life > 0.2f ? 1.0f : p.life * 5.0f);
-    glutSolidSphere(0.05f + p.life * 0.1f, 4, 4);
-    glPopMatrix();
+// F3 overlay, bottom-left
+void drawStats() {
+    char buf[192];
+    float y = 10.0f;
+    glColor3f(1.0f, 1.0f, 0.4f);
+    sprintf(buf, "CPU: %.1f%% of one core", pacer.cpuPercent);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    float budget = dynRes.budgetMs > 0.0f ? dynRes.budgetMs : 1000.0f / pacer.targetFps * 0.8f;
+    sprintf(buf, "Frame: %.2f ms / budget %.2f ms, budget hits %d/s (%d total)",
+        dynRes.frameMs, budget, dynRes.budgetHitsLastSecond, dynRes.budgetHits);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    if (dynRes.enabled)
+        sprintf(buf, "Render scale: %d%% (%dx%d, %s), GPU time %s", (int)(dynRes.scale * 100.0f + 0.5f),
+            dynRes.sceneW, dynRes.sceneH, dynRes.useFbo ? "framebuffer" : "copy", dynRes.timers ? "from timer queries" : "by glFinish");
+    else
+        strcpy(buf, "Render scale: off (F4)");
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Render queue: %d commands, %d state changes, %d redundant dropped, arena %u KB%s",
+        renderStats.lastCommands, renderStats.lastStateChanges, renderStats.lastRedundantDropped,
+        (unsigned)(renderStats.lastArenaBytes / 1024), renderStats.lastDropped ? " (overflow)" : "");
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Entities: %d enemies (%d down), %d/%d bullets, %d/%d particles, %d props, chunks %d/%d",
+        archEnemy->entityCount, archDeadEnemy->entityCount, archBullet->entityCount, MAX_BULLETS,
+        archParticle->entityCount, MAX_PARTICLES, archProp->entityCount, MAX_CHUNKS - world.freeChunkCount, MAX_CHUNKS);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    const OcclusionStats& occ = occlusion.frame;
+    if (occlusion.enabled)
+        sprintf(buf, "Occlusion: hidden %d/%d sectors, %d/%d props, %d/%d enemies (horizon %d, depth %d, off-screen %d), %.2f ms",
+            occ.hidden[OCCLUDEE_SECTOR], occ.tested[OCCLUDEE_SECTOR], occ.hidden[OCCLUDEE_PROP], occ.tested[OCCLUDEE_PROP],
+            occ.hidden[OCCLUDEE_ENEMY], occ.tested[OCCLUDEE_ENEMY], occ.byHorizon, occ.byDepth, occ.outsideView, occ.buildMs);
+    else
+        strcpy(buf, "Occlusion: off (F5)");
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Startup: first frame at %.1f ms, assets %d/%d cached (%.1f ms), lighting %s, layout %s (%.1f ms)",
+        startup.firstFrameMs, ASSET_COUNT - assets.generated, ASSET_COUNT, assets.ms, baked.fromCache ? "cached" : "baked",
+        baked.layoutFromCache ? "cached" : "baked", baked.ms);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Systems: %d in %d stages on %d workers, tick %.3f ms",
+        scheduler.systemCount, scheduler.stageCount, jobPool.workerCount + 1, scheduler.tickMs);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Hits: %d shots x %d enemies, %d in capsules, %d hits, %.3f ms",
+        hitStats.segments, hitStats.segments ? hitStats.pairs / hitStats.segments : 0, hitStats.candidates, hitStats.hits, hitStats.ms);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Snapshots: %d/%d every %d ticks, %u KB each, capture %.1f us, restore %.1f us",
+        snapshots.count, SNAPSHOT_RING, snapshots.every, (unsigned)(sizeof(Snapshot) / 1024), snapshots.captureUs, snapshots.restoreUs);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Input to swap: look p50 %.1f / p95 %.1f / p99 %.1f ms, any input p50 %.1f / p99 %.1f ms (%.1f events/frame%s)",
+        input.look.p50, input.look.p95, input.look.p99, input.any.p50, input.any.p99, input.eventsPerFrame, input.dropped ? ", dropping" : "");
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "Pacing jitter: avg %.2f ms, max %.2f ms (sleep margin %.2f ms)",
+        pacer.jitterAvgMs, pacer.jitterMaxMs, pacer.spinMargin * 1000.0);
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12); y += 16;
+    sprintf(buf, "FPS: %.1f (target %.0f%s)", pacer.fps, pacer.activeFps, pacerIdle() ? ", idle" : "");
+    drawText(10, y, buf, GLUT_BITMAP_HELVETICA_12);
 }
 
-void drawHUD() {
-    glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity(); gluOrtho2D(0, WIN_W, 0, WIN_H);
-    glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity(); glDisable(GL_DEPTH_TEST);
+void drawHUD(const RenderCommand& cmd) {
+    (void)cmd;
 
     // Crosshair
     float cx = WIN_W * 0.5f, cy = WIN_H * 0.5f, len = 10.0f;
-    glColor3f(1, 1, 1); glLineWidth(2.0f);
+    glColor3f(1, 1, 1);
     glBegin(GL_LINES);
     glVertex2f(cx - len, cy); glVertex2f(cx + len, cy);
     glVertex2f(cx, cy - len); glVertex2f(cx, cy + len);
@@ -495,7 +3757,7 @@ void drawHUD() {
     if (gameOver) {
         const char* msg1 = "GAME OVER";
         const char* msg2 = "Better Luck Next Time!";
-        const char* msg3 = "Press ESC to release mouse";
+        const char* msg3 = "Press Enter to play again, ESC to release mouse";
 
         float centerX = WIN_W * 0.5f;
         float centerY = WIN_H * 0.5f;
@@ -517,8 +3779,12 @@ void drawHUD() {
             glutBitmapCharacter(GLUT_BITMAP_HELVETICA_12, *p);
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glPopMatrix(); glMatrixMode(GL_PROJECTION); glPopMatrix(); glMatrixMode(GL_MODELVIEW);
+    if (showStats) drawStats();
+}
+
+void submitHUD() {
+    RenderCommand* cmd = submit(PASS_HUD, BLEND_NONE, 0, MESH_HUD, 0);
+    if (cmd) cmd->draw = drawHUD;
 }
 
 // Helpers
@@ -534,112 +3800,683 @@ bool canSee(const Vec3& from, const Vec3& to) {
     return pitchToPlayer < 60.0f;
 }
 
+// Gameplay randomness, separate from the layout seed; its state is part of
+// a snapshot, so a restored match rolls the same numbers (and, with
+// --fixed-step and the same input, plays out the same way)
+unsigned gameRngState = 1u;
+int gameRand() {
+    gameRngState = gameRngState * 1103515245u + 12345u;
+    return (int)((gameRngState >> 16) & 0x7FFF);
+}
+
+// Pools keep their per-type caps; a spawn over the cap is dropped
+Entity spawnBullet(const Vec3& pos, const Vec3& dir, int owner) {
+    if (archBullet->entityCount >= MAX_BULLETS) { metricsCount(CTR_BULLETS_EXHAUSTED); return NULL_ENTITY; }
+    Entity e = createEntity(archBullet);
+    if (e == NULL_ENTITY) { metricsCount(CTR_BULLETS_EXHAUSTED); return e; }
+    *getComponent<Vec3>(e, COMP_POSITION) = pos;
+    *getComponent<Vec3>(e, COMP_MOTION) = dir;
+    *getComponent<float>(e, COMP_LIFETIME) = 3.0f;
+    getComponent<BulletInfo>(e, COMP_BULLET)->owner = owner;
+    return e;
+}
+
 void fireBullet() {
     if (reloading || bulletsLeft <= 0 || gameOver) return; // ✅ no shooting after game over
-    for (int i = 0; i < MAX_BULLETS; i++) {
-        if (!bullets[i].active) {
-            bullets[i].active = true;
-            bullets[i].pos = camPos;
-            bullets[i].dir = camFront;
-            bullets[i].life = 3.0f;
-            bullets[i].owner = 0;
-            bulletsLeft--;
-            justFired = true;
-            playShootSound();        // ✅ sound on shoot
-            break;
-        }
-    }
+    if (spawnBullet(camPos, camFront, 0) == NULL_ENTITY) return;
+    bulletsLeft--;
+    justFired = true;
+    metricsCount(CTR_SHOTS);
+    playShootSound();        // ✅ sound on shoot
+}
+
+void createParticle(const Vec3& pos) {
+    if (archParticle->entityCount >= MAX_PARTICLES) { metricsCount(CTR_PARTICLES_EXHAUSTED); return; }
+    Entity e = createEntity(archParticle);
+    if (e == NULL_ENTITY) { metricsCount(CTR_PARTICLES_EXHAUSTED); return; }
+    *getComponent<Vec3>(e, COMP_POSITION) = pos;
+    *getComponent<Vec3>(e, COMP_MOTION) = {
+        ((gameRand() % 100) / 50.0f - 1.0f) * 1.5f,
+        ((gameRand() % 100) / 50.0f + 0.5f) * 1.5f,
+        ((gameRand() % 100) / 50.0f - 1.0f) * 1.5f
+    };
+    *getComponent<float>(e, COMP_LIFETIME) = 0.8f + ((gameRand() % 100) / 200.0f);
+}
+
+// Spawns requested by systems are applied between stages
+void deferredParticle(Entity e, const DeferredOp& op) { (void)e; createParticle(op.a); }
+// The shot only counts once its bullet exists: over the pool cap the enemy
+// keeps its cooldown expired and tries again next tick
+void deferredEnemyBullet(Entity e, const DeferredOp& op) {
+    (void)e;
+    if (!entityAlive(op.entity) || world.records[op.entity & 0xFFFF].chunk->archetype != archEnemy) return;
+    if (spawnBullet(op.a, op.b, 1) == NULL_ENTITY) return;
+    getComponent<EnemyCombat>(op.entity, COMP_ENEMY)->shootCooldown = ENEMY_MAX_SHOOT_COOLDOWN * (0.7f + (gameRand() % 60) / 100.0f);
+    const Vec3& dir = *getComponent<Vec3>(op.entity, COMP_MOTION);
+    Vec3 muzzle = op.a;
+    muzzle.x += dir.x * 0.4f;
+    muzzle.z += dir.z * 0.4f;
+    createParticle(muzzle);
 }
 
 void spawnParticle(const Vec3& pos) {
-    for (int i = 0; i < MAX_PARTICLES; i++) {
-        if (!particles[i].active) {
-            particles[i].active = true;
-            particles[i].pos = pos;
-            particles[i].vel = {
-                ((rand() % 100) / 50.0f - 1.0f) * 1.5f,
-                ((rand() % 100) / 50.0f + 0.5f) * 1.5f,
-                ((rand() % 100) / 50.0f - 1.0f) * 1.5f
-            };
-            particles[i].life = 0.8f + ((rand() % 100) / 200.0f);
-            break;
-        }
-    }
+    DeferredOp* op = defer(DEFER_SPAWN, NULL_ENTITY, 0, deferredParticle);
+    if (op) op->a = pos;
+}
+
+// Random spot near the center, on the ground
+Vec3 randomEnemyPosition() {
+    Vec3 p;
+    p.x = ((gameRand() % 40) - 20) * 0.8f;
+    p.z = ((gameRand() % 40) - 20) * 0.8f;
+    p.y = terrainHeight(p.x, p.z) + 1.6f; // ✅ +1.6f = player height
+    return p;
 }
 
 void initEnemies() {
     for (int i = 0; i < MAX_ENEMIES; i++) {
-        enemies[i].active = true;
-        enemies[i].pos = {
-            ((rand() % 40) - 20) * 0.8f,
-            0,
-            ((rand() % 40) - 20) * 0.8f
-        };
-        enemies[i].pos.y = terrainHeight(enemies[i].pos.x, enemies[i].pos.z) + 1.6f; // ✅ +1.6f = player height
-        float ang = (rand() % 360) * 3.14159f / 180.0f;
-        enemies[i].dir = { cosf(ang), 0, sinf(ang) };
-        enemies[i].health = 100.0f;
-        enemies[i].size = 0.4f;
-        enemies[i].flashTimer = 0.0f;
-        enemies[i].moveSpeed = 0.8f;
-        enemies[i].shootCooldown = (rand() % 1000) / 500.0f;
-        enemies[i].canSeePlayer = false;
-        enemies[i].lastSeenTime = 0.0f;
-        enemies[i].deathTimer = 0.0f; // alive
+        Entity e = createEntity(archEnemy);
+        if (e == NULL_ENTITY) return;
+        *getComponent<Vec3>(e, COMP_POSITION) = randomEnemyPosition();
+        float ang = (gameRand() % 360) * 3.14159f / 180.0f;
+        *getComponent<Vec3>(e, COMP_MOTION) = { cosf(ang), 0, sinf(ang) };
+        EnemyCombat* combat = getComponent<EnemyCombat>(e, COMP_ENEMY);
+        combat->health = 100.0f;
+        combat->flashTimer = 0.0f;
+        combat->shootCooldown = (gameRand() % 1000) / 500.0f;
+        EnemyMemory* memory = getComponent<EnemyMemory>(e, COMP_ENEMY_MEMORY);
+        memory->canSeePlayer = false;
+        memory->lastSeenTime = 0.0f;
+        memory->lastSeenPos = camPos;
     }
 }
 
+// Rock placement. Seeded from the clock like the rest of the game, so each
+// run gets a new layout; --layout-seed N pins it. The rocks' lighting is
+// baked apart from the rest (see BAKED LIGHTING), so only a pinned layout is
+// cached and a clock-seeded one costs a rock bake but no cache file.
+unsigned layoutSeed = 0;
+int layoutRand() {
+    layoutSeed = layoutSeed * 1103515245u + 12345u;
+    return (int)((layoutSeed >> 16) & 0x7FFF);
+}
+
 void initEnvironment() {
     if (envInitialized) return;
+
+    // Everything static is composed into world matrices once
+    const PartShape rock = makeShape(SHAPE_SPHERE, 1.0f, 0, 8, 8, { 0.35f, 0.30f, 0.25f });
     for (int i = 0; i < 30; ++i) {
         float x, z;
         do {
-            x = -80 + (rand() % 160);
-            z = -80 + (rand() % 160);
+            x = -80 + (layoutRand() % 160);
+            z = -80 + (layoutRand() % 160);
         } while (x * x + z * z < 100);
         float h = terrainHeight(x, z);
-        rocks[i].pos = { x, h + 0.5f, z };
-        rocks[i].scale = 0.6f + (rand() % 40) / 100.0f;
+        float scale = 0.6f + (layoutRand() % 40) / 100.0f;
+        addProp(mat4TranslateScale(x, h + 0.5f, z, scale, scale * 0.7f, scale), rock, true);
     }
+
+    // Trees
+    const PartShape trunk = makeShape(SHAPE_CONE, 0.4f, 3.0f, 8, 8, { 0.4f, 0.25f, 0.1f });
+    const PartShape leaves = makeShape(SHAPE_CONE, 1.8f, 3.5f, 8, 8, { 0.1f, 0.5f, 0.1f });
+    const Quat upright = quatAxisAngle(-90, 1, 0, 0);
+    const float treeX[2] = { -8.0f, 15.0f }, treeZ[2] = { 12.0f, 5.0f };
+    for (int i = 0; i < 2; ++i) {
+        float h = terrainHeight(treeX[i], treeZ[i]);
+        addProp(mat4FromTRS(treeX[i], h + 1.0f, treeZ[i], upright, 1, 1, 1), trunk);
+        addProp(mat4Translate(treeX[i], h + 3.0f, treeZ[i]), leaves);
+    }
+
+    // Crates
+    const PartShape crate = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.7f, 0.3f, 0.2f });
+    addProp(mat4Translate(2, terrainHeight(2, -2) + 0.5f, -2), crate);
+    addProp(mat4Translate(-3, terrainHeight(-3, 4) + 0.5f, 4), crate);
+
+    // Fence posts
+    const PartShape post = makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.2f, 0.15f, 0.1f });
+    for (float x = -15; x <= 15; x += 5.0f)
+        addProp(mat4TranslateScale(x, terrainHeight(x, -12) + 0.8f, -12, 0.3f, 1.2f, 0.3f), post);
+
+    // Building
+    addProp(mat4TranslateScale(12.0f, terrainHeight(12, -8) + 4.0f, -8.0f, 6.0f, 8.0f, 6.0f),
+        makeShape(SHAPE_CUBE, 1.0f, 0, 0, 0, { 0.55f, 0.55f, 0.55f }));
+    addProp(mat4TranslateScale(12.0f, terrainHeight(12, -8) + 1.0f, -5.0f, 1.2f, 2.0f, 0.1f), post);
     envInitialized = true;
 }
 
+// ---------------------- GAME SYSTEMS -------------------------
+void bulletSystem(float dt, float t) {
+    (void)t;
+    forEachChunk(Q_BULLET, [dt](Chunk* c) {
+        Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        const Vec3* dir = column<Vec3>(c, COMP_MOTION);
+        float* life = column<float>(c, COMP_LIFETIME);
+        const Entity* ids = chunkEntities(c);
+        for (int i = 0; i < c->count; i++) {
+            pos[i] = vecAdd(pos[i], vecScale(dir[i], BULLET_SPEED * dt));
+            life[i] -= dt;
+            if (life[i] <= 0) defer(DEFER_DESTROY, ids[i], 0, 0);
+        }
+    });
+}
+
+void particleSystem(float dt, float t) {
+    (void)t;
+    forEachChunk(Q_PARTICLE, [dt](Chunk* c) {
+        Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        Vec3* vel = column<Vec3>(c, COMP_MOTION);
+        float* life = column<float>(c, COMP_LIFETIME);
+        const Entity* ids = chunkEntities(c);
+        for (int i = 0; i < c->count; i++) {
+            pos[i] = vecAdd(pos[i], vecScale(vel[i], dt));
+            vel[i].y -= 2.0f * dt;
+            life[i] -= dt;
+            if (life[i] <= 0) defer(DEFER_DESTROY, ids[i], 0, 0);
+        }
+    });
+}
+
+void enemyAiSystem(float dt, float t) {
+    forEachChunk(Q_ENEMY, [dt, t](Chunk* c) {
+        Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        Vec3* dir = column<Vec3>(c, COMP_MOTION);
+        EnemyCombat* combat = column<EnemyCombat>(c, COMP_ENEMY);
+        EnemyMemory* memory = column<EnemyMemory>(c, COMP_ENEMY_MEMORY);
+        const Entity* ids = chunkEntities(c);
+        for (int i = 0; i < c->count; i++) {
+            EnemyCombat& e = combat[i];
+            EnemyMemory& m = memory[i];
+            if (e.flashTimer > 0) e.flashTimer -= dt;
+
+            // Vision
+            m.canSeePlayer = canSee(pos[i], camPos);
+            if (m.canSeePlayer) {
+                m.lastSeenTime = t;
+                m.lastSeenPos = camPos;
+            }
+
+            // Turn/move toward last seen
+            if (t - m.lastSeenTime < 3.0f) {
+                Vec3 toTarget = vecSub(m.lastSeenPos, pos[i]);
+                toTarget.y = 0;
+                float len = sqrtf(toTarget.x * toTarget.x + toTarget.z * toTarget.z);
+                if (len > 0.1f) {
+                    toTarget.x /= len;
+                    toTarget.z /= len;
+                    dir[i].x = dir[i].x * 0.94f + toTarget.x * 0.06f;
+                    dir[i].z = dir[i].z * 0.94f + toTarget.z * 0.06f;
+                    vecNormalize(dir[i]);
+                }
+            }
+            else {
+                if ((gameRand() % 200) == 0) {
+                    float ang = (gameRand() % 360) * 3.14159f / 180.0f;
+                    dir[i] = { cosf(ang), 0, sinf(ang) };
+                }
+            }
+
+            // Move (sync to terrain)
+            if ((gameRand() % 100) < 20) {
+                float nx = pos[i].x + dir[i].x * ENEMY_MOVE_SPEED * dt * 0.8f;
+                float nz = pos[i].z + dir[i].z * ENEMY_MOVE_SPEED * dt * 0.8f;
+                float ny = terrainHeight(nx, nz) + 1.6f; // ✅ +1.6f = player foot height
+                if (fabs(ny - pos[i].y) < 1.0f) { // gentle slope
+                    pos[i].x = nx;
+                    pos[i].z = nz;
+                    pos[i].y = ny;
+                }
+            }
+
+            // Shooting
+            e.shootCooldown -= dt;
+            if (m.canSeePlayer && e.shootCooldown <= 0.0f && archBullet->entityCount < MAX_BULLETS) {
+                DeferredOp* op = defer(DEFER_SPAWN, ids[i], 0, deferredEnemyBullet);
+                if (!op) continue;
+                op->a = pos[i];
+                op->a.y += 1.4f;
+                op->b = vecSub(camPos, op->a);
+                vecNormalize(op->b);
+            }
+        }
+    });
+}
+
+void deferredKill(Entity e, const DeferredOp& op) { *getComponent<float>(e, COMP_RESPAWN) = op.f; }
+
+void deferredRespawn(Entity e, const DeferredOp& op) {
+    (void)op;
+    metricsCount(CTR_RESPAWNS);
+    *getComponent<Vec3>(e, COMP_POSITION) = randomEnemyPosition(); // ✅ correct height
+    EnemyCombat* combat = getComponent<EnemyCombat>(e, COMP_ENEMY);
+    combat->health = 100.0f;
+    combat->flashTimer = 0.0f;
+    combat->shootCooldown = (gameRand() % 1000) / 500.0f;
+}
+
+void respawnSystem(float dt, float t) {
+    (void)t;
+    forEachChunk(Q_DEAD_ENEMY, [dt](Chunk* c) {
+        float* deathTimer = column<float>(c, COMP_RESPAWN);
+        const Entity* ids = chunkEntities(c);
+        for (int i = 0; i < c->count; i++) {
+            deathTimer[i] -= dt;
+            if (deathTimer[i] <= 0.0f) defer(DEFER_MOVE, ids[i], archEnemy, deferredRespawn);
+        }
+    });
+}
+
+void hitPlayer() {
+    playerHealth -= 25;
+    damageFlash = 0.4f;
+    playHitSound();    // ✅ sound when hit
+    if (playerHealth <= 0 && !gameOver) {
+        playerHealth = 0;
+        gameOver = true;       // ✅ flag game over
+        playGameOverSound();   // ✅ sound for game over
+        printf("\nGAME OVER! Final Score: %d\n", score);
+        printf("Better Luck Next Time!\n");
+    }
+}
+
+// Bullets are tested over the distance they moved this tick
+void collisionSystem(float dt, float t) {
+    (void)t;
+    double start = preciseSeconds();
+    float step = fmaxf(BULLET_SPEED * dt, 1e-3f);
+    static Entity shotIds[HIT_MAX_SEGMENTS];
+    static float* shotLife[HIT_MAX_SEGMENTS];
+    HitBatch& batch = hitBatch;
+    batch.count = 0;
+
+    forEachChunk(Q_BULLET, [&](Chunk* bc) {
+        const Vec3* bpos = column<Vec3>(bc, COMP_POSITION);
+        const Vec3* bdir = column<Vec3>(bc, COMP_MOTION);
+        const BulletInfo* info = column<BulletInfo>(bc, COMP_BULLET);
+        float* life = column<float>(bc, COMP_LIFETIME);
+        const Entity* bids = chunkEntities(bc);
+        for (int i = 0; i < bc->count; i++) {
+            if (life[i] <= 0) continue;
+            Vec3 from = vecSub(bpos[i], vecScale(bdir[i], step));
+
+            // Enemy bullet → player, a capsule 1.6 high
+            if (info[i].owner == 1) {
+                Vec3 base = { camPos.x, camPos.y - 0.4f, camPos.z };
+                if (segmentCapsuleDist2(from, vecSub(bpos[i], from), base, 0.8f) < 0.4f * 0.4f) {
+                    life[i] = 0;
+                    defer(DEFER_DESTROY, bids[i], 0, 0);
+                    hitPlayer();
+                }
+                continue;
+            }
+
+            int slot = hitAddSegment(batch, from, bpos[i]);
+            if (slot < 0) continue;
+            shotIds[slot] = bids[i];
+            shotLife[slot] = &life[i];
+        }
+    });
+
+    // Player bullets → enemy parts
+    Vec3 targets[MAX_ENEMIES];
+    EnemyCombat* combat[MAX_ENEMIES];
+    Entity enemyIds[MAX_ENEMIES];
+    int targetCount = 0;
+    forEachChunk(Q_ENEMY, [&](Chunk* ec) {
+        const Vec3* epos = column<Vec3>(ec, COMP_POSITION);
+        EnemyCombat* ecombat = column<EnemyCombat>(ec, COMP_ENEMY);
+        const Entity* eids = chunkEntities(ec);
+        for (int j = 0; j < ec->count && targetCount < MAX_ENEMIES; j++) {
+            targets[targetCount] = epos[j];
+            combat[targetCount] = &ecombat[j];
+            enemyIds[targetCount++] = eids[j];
+        }
+    });
+    if (batch.count > 0 && targetCount > 0) hitTestBatch(batch, targets, targetCount);
+    else hitStats.segments = hitStats.pairs = hitStats.candidates = hitStats.hits = 0;
+
+    // A bullet is spent on the first enemy it reaches, it does not pass
+    // through to damage whoever stands behind. Kills only leave the enemy
+    // archetype at the next flush, so a bullet whose nearest enemy went down
+    // earlier in this loop is retested against the ones still standing.
+    bool down[MAX_ENEMIES];
+    for (int j = 0; j < targetCount; j++) down[j] = combat[j]->health <= 0;
+    for (int i = 0; i < batch.count && targetCount > 0; i++) {
+        int j = batch.target[i];
+        if (j >= 0 && down[j]) {
+            hitTestSegment(batch, i, targets, down, targetCount);
+            j = batch.target[i];
+        }
+        if (j < 0) continue;
+        EnemyCombat& e = *combat[j];
+        *shotLife[i] = 0;
+        defer(DEFER_DESTROY, shotIds[i], 0, 0);
+        metricsCount(CTR_HITS);
+        e.flashTimer = 0.25f;
+        spawnParticle({ batch.x0[i] + batch.dx[i] * batch.t[i], batch.y0[i] + batch.dy[i] * batch.t[i], batch.z0[i] + batch.dz[i] * batch.t[i] });
+        e.health -= BULLET_DAMAGE * hitboxes.parts[batch.part[i]].damage;
+        if (e.health <= 0) {
+            down[j] = true;
+            DeferredOp* op = defer(DEFER_MOVE, enemyIds[j], archDeadEnemy, deferredKill);
+            if (op) op->f = 2.0f; // ✅ die for 2 seconds
+            score += 100;
+        }
+    }
+    hitStats.ms = (float)((preciseSeconds() - start) * 1000.0);
+    metricsRecord(HIST_COLLISION_PAIRS, (uint64_t)hitStats.pairs);
+}
+
+// Program order; the scheduler derives stages from the declared access
+void initSystems() {
+    const uint32_t POS = BIT(COMP_POSITION), MOTION = BIT(COMP_MOTION), LIFE = BIT(COMP_LIFETIME);
+    registerSystem("bullets", Q_BULLET, 0, MOTION, POS | LIFE, bulletSystem);
+    registerSystem("particles", Q_PARTICLE, 0, 0, POS | MOTION | LIFE, particleSystem);
+    registerSystem("enemy AI", Q_ENEMY, 0, RES_PLAYER, POS | MOTION | BIT(COMP_ENEMY) | BIT(COMP_ENEMY_MEMORY) | RES_RNG, enemyAiSystem);
+    registerSystem("respawn", Q_DEAD_ENEMY, 0, 0, BIT(COMP_RESPAWN) | RES_RNG, respawnSystem);
+    registerSystem("collisions", Q_BULLET, Q_ENEMY, POS | MOTION | BIT(COMP_BULLET), LIFE | BIT(COMP_ENEMY) | RES_PLAYER, collisionSystem);
+}
+// --------------------------------------------------------------
+
+// Snapshot capture and restore
+void captureSnapshot(Snapshot& s) {
+    s.tick = snapshots.tick;
+    s.time = gameSeconds();
+    s.rng = gameRngState;
+    s.camPos = camPos;
+    s.yaw = yaw; s.pitch = pitch; s.verticalVelocity = verticalVelocity;
+    s.score = score; s.bulletsLeft = bulletsLeft; s.playerHealth = playerHealth;
+    s.reloadTimer = reloadTimer; s.damageFlash = damageFlash;
+    s.onGround = onGround; s.reloading = reloading; s.gameOver = gameOver;
+
+    s.enemyCount = 0;
+    forEachChunk(BIT(COMP_ENEMY_MEMORY), [&s](Chunk* c) {
+        const Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        const Vec3* dir = column<Vec3>(c, COMP_MOTION);
+        const EnemyMemory* memory = column<EnemyMemory>(c, COMP_ENEMY_MEMORY);
+        bool alive = c->archetype == archEnemy;
+        for (int i = 0; i < c->count && s.enemyCount < MAX_ENEMIES; i++) {
+            SnapshotEnemy& e = s.enemies[s.enemyCount++];
+            e.pos = pos[i]; e.dir = dir[i]; e.memory = memory[i];
+            e.combat = alive ? column<EnemyCombat>(c, COMP_ENEMY)[i] : EnemyCombat{ 0.0f, 0.0f, 0.0f };
+            e.respawn = alive ? -1.0f : column<float>(c, COMP_RESPAWN)[i];
+        }
+    });
+    s.bulletCount = 0;
+    forEachChunk(Q_BULLET, [&s](Chunk* c) {
+        const Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        const Vec3* dir = column<Vec3>(c, COMP_MOTION);
+        const float* life = column<float>(c, COMP_LIFETIME);
+        const BulletInfo* info = column<BulletInfo>(c, COMP_BULLET);
+        for (int i = 0; i < c->count && s.bulletCount < MAX_BULLETS; i++)
+            s.bullets[s.bulletCount++] = { pos[i], dir[i], life[i], info[i].owner };
+    });
+    s.particleCount = 0;
+    forEachChunk(Q_PARTICLE, [&s](Chunk* c) {
+        const Vec3* pos = column<Vec3>(c, COMP_POSITION);
+        const Vec3* vel = column<Vec3>(c, COMP_MOTION);
+        const float* life = column<float>(c, COMP_LIFETIME);
+        for (int i = 0; i < c->count && s.particleCount < MAX_PARTICLES; i++)
+            s.particles[s.particleCount++] = { pos[i], vel[i], life[i] };
+    });
+}
+
+void restoreSnapshot(const Snapshot& s) {
+    double start = preciseSeconds();
+    snapshots.tick = s.tick;
+    float shift = gameSeconds() - s.time;
+    gameRngState = s.rng;
+    camPos = s.camPos;
+    yaw = s.yaw; pitch = s.pitch; verticalVelocity = s.verticalVelocity;
+    score = s.score; bulletsLeft = s.bulletsLeft; playerHealth = s.playerHealth;
+    reloadTimer = s.reloadTimer; damageFlash = s.damageFlash;
+    onGround = s.onGround; reloading = s.reloading; gameOver = s.gameOver;
+    justFired = false;
+    input.lookDx = input.lookDy = 0.0f;
+    updateCameraVectors();
+
+    clearArchetype(archEnemy);
+    clearArchetype(archDeadEnemy);
+    clearArchetype(archBullet);
+    clearArchetype(archParticle);
+    for (int i = 0; i < s.enemyCount; i++) {
+        const SnapshotEnemy& se = s.enemies[i];
+        Entity e = createEntity(se.respawn < 0.0f ? archEnemy : archDeadEnemy);
+        if (e == NULL_ENTITY) break;
+        *getComponent<Vec3>(e, COMP_POSITION) = se.pos;
+        *getComponent<Vec3>(e, COMP_MOTION) = se.dir;
+        EnemyMemory* memory = getComponent<EnemyMemory>(e, COMP_ENEMY_MEMORY);
+        *memory = se.memory;
+        memory->lastSeenTime += shift;
+        if (se.respawn < 0.0f) *getComponent<EnemyCombat>(e, COMP_ENEMY) = se.combat;
+        else *getComponent<float>(e, COMP_RESPAWN) = se.respawn;
+    }
+    for (int i = 0; i < s.bulletCount; i++) {
+        const SnapshotBullet& b = s.bullets[i];
+        Entity e = spawnBullet(b.pos, b.dir, b.owner);
+        if (e != NULL_ENTITY) *getComponent<float>(e, COMP_LIFETIME) = b.life;
+    }
+    for (int i = 0; i < s.particleCount; i++) {
+        const SnapshotParticle& p = s.particles[i];
+        Entity e = createEntity(archParticle);
+        if (e == NULL_ENTITY) break;
+        *getComponent<Vec3>(e, COMP_POSITION) = p.pos;
+        *getComponent<Vec3>(e, COMP_MOTION) = p.vel;
+        *getComponent<float>(e, COMP_LIFETIME) = p.life;
+    }
+    snapshots.restoreUs = (float)((preciseSeconds() - start) * 1e6);
+}
+
+// Call once per simulation tick
+void snapshotTick() {
+    snapshots.tick++;
+    if (snapshots.every <= 0 || snapshots.tick % snapshots.every) return;
+    double start = preciseSeconds();
+    snapshots.newest = (snapshots.newest + 1) % SNAPSHOT_RING;
+    if (snapshots.count < SNAPSHOT_RING) snapshots.count++;
+    captureSnapshot(snapshots.ring[snapshots.newest]);
+    snapshots.captureUs = (float)((preciseSeconds() - start) * 1e6);
+}
+
+// Each call goes one snapshot further back; the ring refills from there
+void rewindSnapshot() {
+    if (snapshots.count == 0) return;
+    const Snapshot& s = snapshots.ring[snapshots.newest];
+    restoreSnapshot(s);
+    snapshots.newest = (snapshots.newest + SNAPSHOT_RING - 1) % SNAPSHOT_RING;
+    snapshots.count--;
+    printf("Rewound to tick %u in %.1f us (%d older snapshots left)\n", s.tick, snapshots.restoreUs, snapshots.count);
+}
+
+void restartGame() {
+    restoreSnapshot(snapshots.start);
+    gameRngState = (unsigned)time(NULL);   // same layout, a different match
+    snapshots.newest = -1;
+    snapshots.count = 0;
+    printf("Restarted in %.1f us\n", snapshots.restoreUs);
+}
+
+struct SnapshotFileHeader {
+    char magic[8];
+    uint32_t size;        // sizeof(Snapshot), which changes with the caps
+    uint32_t reserved;
+};
+
+void saveCheckpoint() {
+    static Snapshot s;
+    captureSnapshot(s);
+    SnapshotFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+    h.size = sizeof(Snapshot);
+    // Written beside the old checkpoint and renamed over it, so a crash mid-save keeps the old one
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", snapshots.checkpoint);
+    FILE* f = fopen(tmp, "wb");
+    bool ok = f && fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(&s, sizeof(s), 1, f) == 1;
+    if (f && fclose(f) != 0) ok = false;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp, snapshots.checkpoint, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp, snapshots.checkpoint) == 0;
+#endif
+    if (f && !ok) remove(tmp);
+    if (ok) printf("Checkpoint at tick %u saved to %s\n", s.tick, snapshots.checkpoint);
+    else printf("Checkpoint: cannot write %s\n", snapshots.checkpoint);
+}
+
+bool loadCheckpoint(const char* path) {
+    static Snapshot s;
+    SnapshotFileHeader h;
+    FILE* f = fopen(path, "rb");
+    bool ok = f && fread(&h, sizeof(h), 1, f) == 1 && !memcmp(h.magic, SNAPSHOT_MAGIC, 8) &&
+        h.size == sizeof(Snapshot) && fread(&s, sizeof(s), 1, f) == 1;
+    if (f) fclose(f);
+    if (!ok) { printf("Checkpoint: %s is missing or from another build\n", path); return false; }
+    // Its clock is from another run, so enemies start out having lost the player
+    for (int i = 0; i < s.enemyCount; i++) s.enemies[i].memory.lastSeenTime = s.time - 100.0f;
+    restoreSnapshot(s);
+    printf("Resumed tick %u from %s in %.1f us\n", s.tick, path, snapshots.restoreUs);
+    return true;
+}
+
+// Call after the world is initialized
+void initSnapshots(const char* resume) {
+    captureSnapshot(snapshots.start);
+    if (resume) loadCheckpoint(resume);
+    printf("Snapshots: %u bytes each, every %d ticks into a ring of %d (%u KB)\n",
+        (unsigned)sizeof(Snapshot), snapshots.every, SNAPSHOT_RING, (unsigned)(sizeof(snapshots.ring) / 1024));
+}
+// --------------------------------------------------------------
+
 // GLUT callbacks
-void reshape(int w, int h) { WIN_W = w; WIN_H = h; glViewport(0, 0, w, h); }
+void reshape(int w, int h) { WIN_W = w; WIN_H = h; glViewport(0, 0, w, h); dynRes.dirty = true; projDirty = true; }
+// Motion events queued before the warp still arrive afterwards with pre-warp
+// coordinates, so deltas stay measured from the pre-warp position until the
+// event at the warp target shows up; that one only moves the reference.
+void warpPointerToCenter() {
+    input.warpX = WIN_W / 2; input.warpY = WIN_H / 2;
+    glutWarpPointer(input.warpX, input.warpY);
+    input.warpInFlight = true;
+    input.warpFrames = 0;
+    input.warpPending = false;
+}
 void passiveMouse(int x, int y) {
+    if (input.warpInFlight && x == input.warpX && y == input.warpY) {
+        input.warpInFlight = false;
+        input.lastX = x; input.lastY = y;
+        return;
+    }
+    int dx = input.lastX < 0 ? 0 : x - input.lastX, dy = input.lastY < 0 ? 0 : input.lastY - y;
+    input.lastX = x; input.lastY = y;
     if (!cursorCaptured || gameOver) return;  // ✅ do not rotate camera after game over
-    if (ignoreWarp) { ignoreWarp = false; return; }
-    int cx = WIN_W / 2, cy = WIN_H / 2;
-    float dx = float(x - cx), dy = float(cy - y);
-    yaw += dx * mouseSensitivity; pitch += dy * mouseSensitivity;
-    if (pitch > 89) pitch = 89; if (pitch < -89) pitch = -89;
-    updateCameraVectors();
-    ignoreWarp = true; glutWarpPointer(cx, cy);
+    if (dx || dy) pushInput(INPUT_MOUSE_MOVE, dx, dy, input.modifiers);
 }
 void keyboardDown(unsigned char key, int x, int y) {
-    keyDown[key] = true;
-    if (key == 27) {
-        cursorCaptured = !cursorCaptured;
-        if (cursorCaptured) { glutSetCursor(GLUT_CURSOR_NONE); int cx = WIN_W / 2, cy = WIN_H / 2; ignoreWarp = true; glutWarpPointer(cx, cy); }
-        else glutSetCursor(GLUT_CURSOR_INHERIT);
-    }
-    if (key == 'r' || key == 'R') {
-        if (!reloading && bulletsLeft < 30 && !gameOver) {
-            reloading = true;
-            reloadTimer = reloadTime;
-            playReloadSound();       // ✅ sound on reload
+    (void)x; (void)y;
+    pushInput(INPUT_KEY_DOWN, key, 0, glutGetModifiers());
+    if (key == 27 || key == 13) pacerKick();   // may be leaving the idle rate
+}
+void keyboardUp(unsigned char key, int x, int y) {
+    (void)x; (void)y;
+    pushInput(INPUT_KEY_UP, key, 0, glutGetModifiers());
+}
+void specialDown(int key, int x, int y) {
+    (void)x; (void)y;
+    if (key == GLUT_KEY_F3) showStats = !showStats;
+    if (key == GLUT_KEY_F4) { dynRes.enabled = !dynRes.enabled; dynRes.scale = 1.0f; }
+    if (key == GLUT_KEY_F5) occlusion.enabled = !occlusion.enabled;
+    if (key == GLUT_KEY_F6) { rewindSnapshot(); pacerKick(); }
+    if (key == GLUT_KEY_F7) saveCheckpoint();
+    if (key == GLUT_KEY_F8) { restartGame(); pacerKick(); }
+}
+void entry(int state) {
+    pointerInWindow = (state == GLUT_ENTERED);
+    if (pointerInWindow) pacerKick();
+}
+// Unlike glutVisibilityFunc this also reports a window covered by others
+void windowStatus(int state) {
+    windowVisible = state != GLUT_HIDDEN && state != GLUT_FULLY_COVERED;
+    if (windowVisible) pacerKick();
+}
+void mouseClick(int button, int state, int x, int y) {
+    passiveMouse(x, y);
+    if (state == GLUT_DOWN) pushInput(INPUT_BUTTON_DOWN, button, 0, glutGetModifiers());
+}
+
+void applyLook() {
+    if (input.lookDx == 0.0f && input.lookDy == 0.0f) return;
+    yaw += input.lookDx * mouseSensitivity; pitch += input.lookDy * mouseSensitivity;
+    if (pitch > 89) pitch = 89;
+    if (pitch < -89) pitch = -89;
+    input.lookDx = input.lookDy = 0.0f;
+    updateCameraVectors();
+}
+
+// Start of frame: replays queued events in order. Look deltas are only
+// collected, except that a shot first takes the aim the player had when
+// the button went down.
+void processInput() {
+    InputEvent e;
+    while (popInput(e)) {
+        if (input.oldestEvent == 0.0) input.oldestEvent = e.time;
+        input.frameEvents++;
+        input.modifiers = e.modifiers;
+        switch (e.type) {
+        case INPUT_MOUSE_MOVE:
+            if (input.oldestLook == 0.0) input.oldestLook = e.time;
+            input.lookDx += e.a; input.lookDy += e.b;
+            input.warpPending = true;
+            break;
+        case INPUT_KEY_DOWN:
+            keyDown[e.a] = true;
+            if (e.a == 27) {
+                cursorCaptured = !cursorCaptured;
+                if (cursorCaptured) { glutSetCursor(GLUT_CURSOR_NONE); warpPointerToCenter(); }
+                else glutSetCursor(GLUT_CURSOR_INHERIT);
+                input.lookDx = input.lookDy = 0.0f;
+            }
+            if (e.a == 13 && gameOver) restartGame();
+            if (e.a == 'r' || e.a == 'R') {
+                if (!reloading && bulletsLeft < 30 && !gameOver) {
+                    reloading = true;
+                    reloadTimer = reloadTime;
+                    playReloadSound();       // ✅ sound on reload
+                }
+            }
+            break;
+        case INPUT_KEY_UP:
+            keyDown[e.a] = false;
+            break;
+        case INPUT_BUTTON_DOWN:
+            if (e.a == GLUT_LEFT_BUTTON) {
+                applyLook();
+                fireBullet();
+            }
+            break;
         }
     }
 }
-void keyboardUp(unsigned char key, int x, int y) { keyDown[key] = false; }
-void specialDown(int key, int x, int y) { (void)key; (void)x; (void)y; }
-void mouseClick(int button, int state, int x, int y) {
-    if (button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) fireBullet();
+
+// Late latch: the frame's remaining mouse motion goes in just before the
+// view is built, and the pointer is recentred once.
+void latchLook() {
+    applyLook();
+    // No event for a warp to where the pointer already was; stop waiting
+    if (input.warpInFlight && ++input.warpFrames > 3) {
+        input.warpInFlight = false;
+        input.lastX = input.warpX; input.lastY = input.warpY;
+    }
+    // Warping while another window has focus would drag the user's pointer around
+    if (input.warpPending && !input.warpInFlight && cursorCaptured && windowFocused()) warpPointerToCenter();
 }
 
 // Display
 void display() {
-    float t = nowSeconds(), dt = (lastTime == 0 ? 0.016f : t - lastTime); lastTime = t;
+    double frameStart = preciseSeconds();
+    float t = gameSeconds();
+    float dt = snapshots.fixedDt > 0.0f ? snapshots.fixedDt : pacerSmoothDt(lastTime == 0 ? 0.016f : t - lastTime);
+    lastTime = t;
+    processInput();
 
     // Stop game simulation after game over (but still render)
     if (!gameOver) {
@@ -649,7 +4486,7 @@ void display() {
         if (keyDown['s'] || keyDown['S']) camPos = vecSub(camPos, vecScale(camFront, speed));
         if (keyDown['a'] || keyDown['A']) camPos = vecSub(camPos, vecScale(camRight, speed));
         if (keyDown['d'] || keyDown['D']) camPos = vecAdd(camPos, vecScale(camRight, speed));
-        int mod = glutGetModifiers(); moveSpeed = (mod & GLUT_ACTIVE_SHIFT) ? 9.0f : 5.0f;
+        moveSpeed = (input.modifiers & GLUT_ACTIVE_SHIFT) ? 9.0f : 5.0f;
 
         // Jump & gravity
         if (keyDown[' ']) {
@@ -676,264 +4513,142 @@ void display() {
             }
         }
 
-        // Bullets
-        for (int i = 0; i < MAX_BULLETS; i++) {
-            if (bullets[i].active) {
-                bullets[i].pos = vecAdd(bullets[i].pos, vecScale(bullets[i].dir, 15.0f * dt));
-                bullets[i].life -= dt;
-                if (bullets[i].life <= 0) bullets[i].active = false;
-            }
-        }
-
-        // Particles
-        for (int i = 0; i < MAX_PARTICLES; i++) {
-            if (particles[i].active) {
-                particles[i].pos = vecAdd(particles[i].pos, vecScale(particles[i].vel, dt));
-                particles[i].vel.y -= 2.0f * dt;
-                particles[i].life -= dt;
-                if (particles[i].life <= 0) particles[i].active = false;
-            }
-        }
-
-        // Enemies AI & Update
-        for (int i = 0; i < MAX_ENEMIES; i++) {
-            Enemy& e = enemies[i];
-            if (!e.active || e.deathTimer > 0.0f) continue;
-
-            if (e.flashTimer > 0) e.flashTimer -= dt;
-
-            // Vision
-            e.canSeePlayer = canSee(e.pos, camPos);
-            if (e.canSeePlayer) {
-                e.lastSeenTime = t;
-                e.lastSeenPos = camPos;
-            }
-
-            // Turn/move toward last seen
-            if (t - e.lastSeenTime < 3.0f) {
-                Vec3 toTarget = vecSub(e.lastSeenPos, e.pos);
-                toTarget.y = 0;
-                float len = sqrtf(toTarget.x * toTarget.x + toTarget.z * toTarget.z);
-                if (len > 0.1f) {
-                    toTarget.x /= len;
-                    toTarget.z /= len;
-                    e.dir.x = e.dir.x * 0.94f + toTarget.x * 0.06f;
-                    e.dir.z = e.dir.z * 0.94f + toTarget.z * 0.06f;
-                    vecNormalize(e.dir);
-                }
-            }
-            else {
-                if ((rand() % 200) == 0) {
-                    float ang = (rand() % 360) * 3.14159f / 180.0f;
-                    e.dir = { cosf(ang), 0, sinf(ang) };
-                }
-            }
-
-            // Move (sync to terrain)
-            if ((rand() % 100) < 20) {
-                float nx = e.pos.x + e.dir.x * e.moveSpeed * dt * 0.8f;
-                float nz = e.pos.z + e.dir.z * e.moveSpeed * dt * 0.8f;
-                float ny = terrainHeight(nx, nz) + 1.6f; // ✅ +1.6f = player foot height
-                if (fabs(ny - e.pos.y) < 1.0f) { // gentle slope
-                    e.pos.x = nx;
-                    e.pos.z = nz;
-                    e.pos.y = ny;
-                }
-            }
-
-            // Shooting
-            e.shootCooldown -= dt;
-            if (e.canSeePlayer && e.shootCooldown <= 0.0f) {
-                for (int bi = 0; bi < MAX_BULLETS; bi++) {
-                    if (!bullets[bi].active) {
-                        bullets[bi].active = true;
-                        bullets[bi].pos = e.pos;
-                        bullets[bi].pos.y += 1.4f;
-                        bullets[bi].dir = vecSub(camPos, bullets[bi].pos);
-                        vecNormalize(bullets[bi].dir);
-                        bullets[bi].life = 3.0f;
-                        bullets[bi].owner = 1;
-                        e.shootCooldown = e.maxShootCooldown * (0.7f + (rand() % 60) / 100.0f);
-                        Vec3 muzzle = e.pos;
-                        muzzle.x += e.dir.x * 0.4f;
-                        muzzle.z += e.dir.z * 0.4f;
-                        muzzle.y += 1.4f;
-                        spawnParticle(muzzle);
-                        break;
-                    }
-                }
-            }
-        }
-
-        // Handle enemy death & respawn
-        for (int i = 0; i < MAX_ENEMIES; i++) {
-            Enemy& e = enemies[i];
-            if (e.deathTimer > 0.0f) {
-                e.deathTimer -= dt;
-                if (e.deathTimer <= 0.0f) {
-                    // Respawn
-                    e.pos.x = ((rand() % 40) - 20) * 0.8f;
-                    e.pos.z = ((rand() % 40) - 20) * 0.8f;
-                    e.pos.y = terrainHeight(e.pos.x, e.pos.z) + 1.6f; // ✅ correct height
-                    e.health = 100.0f;
-                    e.active = true;
-                    e.flashTimer = 0.0f;
-                    e.shootCooldown = (rand() % 1000) / 500.0f;
-                }
-            }
-        }
-
-        // Collisions
-        for (int i = 0; i < MAX_BULLETS; i++) {
-            if (!bullets[i].active) continue;
-
-            // Enemy bullet → player
-            if (bullets[i].owner == 1) {
-                Vec3 toPlayer = vecSub(camPos, bullets[i].pos);
-                float distHoriz = sqrtf(toPlayer.x * toPlayer.x + toPlayer.z * toPlayer.z);
-                if (distHoriz < 0.4f && fabs(toPlayer.y) < 0.8f) {
-                    bullets[i].active = false;
-                    playerHealth -= 25;
-                    damageFlash = 0.4f;
-                    playHitSound();    // ✅ sound when hit
-                    if (playerHealth <= 0 && !gameOver) {
-                        playerHealth = 0;
-                        gameOver = true;       // ✅ flag game over
-                        playGameOverSound();   // ✅ sound for game over
-                        printf("\nGAME OVER! Final Score: %d\n", score);
-                        printf("Better Luck Next Time!\n");
-                    }
-                }
-            }
-
-            // Player bullet → enemy
-            if (bullets[i].owner == 0) {
-                for (int j = 0; j < MAX_ENEMIES; j++) {
-                    Enemy& e = enemies[j];
-                    if (!e.active || e.deathTimer > 0.0f) continue;
-                    Vec3 diff = vecSub(bullets[i].pos, e.pos);
-                    float distHoriz = sqrtf(diff.x * diff.x + diff.z * diff.z);
-                    if (distHoriz < e.size && fabs(diff.y) < 1.2f) {
-                        bullets[i].active = false;
-                        e.flashTimer = 0.25f;
-                        spawnParticle(e.pos);
-                        e.health -= 34.0f;
-                        if (e.health <= 0 && e.deathTimer <= 0.0f) {
-                            e.deathTimer = 2.0f; // ✅ die for 2 seconds
-                            score += 100;
-                        }
-                    }
-                }
-            }
-        }
+        // Bullets, particles, enemy AI, respawns, collisions
+        runSystems(dt, t);
+        snapshotTick();
     } // end if !gameOver
 
-    // Render
-    glClearColor(0.5f, 0.7f, 1.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    glEnable(GL_FOG);
-    GLfloat fogColor[4] = { 0.5f, 0.7f, 1.0f, 1.0f };
-    glFogi(GL_FOG_MODE, GL_EXP2);
-    glFogfv(GL_FOG_COLOR, fogColor);
-    glFogf(GL_FOG_DENSITY, 0.005f);
-    glHint(GL_FOG_HINT, GL_NICEST);
-
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(70.0f, (double)WIN_W / (double)WIN_H, 0.1f, 300.0f);
-    updateCameraVectors();
-    applyView();
-
-    glEnable(GL_LIGHTING); glEnable(GL_LIGHT0);
-    const float sunAngle = 0.8f;
-    float lightpos[4] = {
-        cosf(sunAngle) * 120.0f,
-        80.0f + sinf(sunAngle) * 60.0f,
-        sinf(sunAngle) * 120.0f,
-        0
-    };
-    float lightcol[4] = { 0.9f, 0.85f, 0.75f, 1 };
-    glLightfv(GL_LIGHT0, GL_POSITION, lightpos);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, lightcol);
-    glEnable(GL_COLOR_MATERIAL);
-    glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
-
-    drawSkydome();
-    drawFloor();
-    drawEnvironment();
-    for (int i = 0; i < MAX_ENEMIES; i++)
-        drawEnemy(enemies[i]); // draws only if alive
-    for (int i = 0; i < MAX_BULLETS; i++)
-        if (bullets[i].active) drawBullet(bullets[i]);
-    for (int i = 0; i < MAX_PARTICLES; i++)
-        if (particles[i].active) drawParticle(particles[i]);
+    // Render: build matrices, record commands, then replay them
+    renderBeginFrame();
+    updateProjectionMatrix();
+    latchLook();
+    updateViewMatrix();
+    transformScene();
+    occlusionBegin(camPos, viewMatrix, projMatrix);
 
-    glDisable(GL_LIGHTING);
-    glDisable(GL_COLOR_MATERIAL);
-    glDisable(GL_FOG);
+    submitSkydome();
+    submitFloor();
+    submitEnvironment();
+    submitEntities();
 
     // Damage flash
     if (damageFlash > 0.0f) {
-        glDisable(GL_DEPTH_TEST);
-        glMatrixMode(GL_PROJECTION); glPushMatrix(); glLoadIdentity(); gluOrtho2D(0, 1, 0, 1);
-        glMatrixMode(GL_MODELVIEW); glPushMatrix(); glLoadIdentity();
-        glColor4f(1.0f, 0.2f, 0.2f, damageFlash * 0.8f);
-        glBegin(GL_QUADS);
-        glVertex2f(0, 0); glVertex2f(1, 0); glVertex2f(1, 1); glVertex2f(0, 1);
-        glEnd();
-        glPopMatrix(); glMatrixMode(GL_PROJECTION); glPopMatrix(); glMatrixMode(GL_MODELVIEW);
-        glEnable(GL_DEPTH_TEST);
+        submitDamageFlash();
         damageFlash -= dt;
     }
 
-    drawHUD();
+    submitHUD();
 
     // Gun
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
     if (!gameOver) // ✅ don't draw gun after death (optional, remove if you want gun visible)
-        drawGun();
-    glEnable(GL_LIGHTING);
-    glEnable(GL_DEPTH_TEST);
+        submitGun();
+
+    if (dynRes.enabled) gpuTimerBegin();
+    beginScene();
+    glClearColor(0.5f, 0.7f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    executeCommands(PASS_SKY, PASS_TRANSLUCENT);
+    endScene();
+    renderStateInvalidate();
+    executeCommands(PASS_OVERLAY, PASS_GUN);
+
+    // Frame time for the resolution controller has to include the GPU's share
+    float gpuMs = dynRes.enabled ? gpuTimerEnd() : 0.0f;
+    if (dynRes.enabled && gpuMs < 0.0f) glFinish();
+    float workMs = fmaxf((float)((preciseSeconds() - frameStart) * 1000.0), gpuMs);
+    dynResUpdate(workMs);
+    metricsRecord(HIST_FRAME, (uint64_t)(workMs * 1000.0f));
+    metricsSet(GAUGE_BULLETS, archBullet->entityCount);
+    metricsSet(GAUGE_PARTICLES, archParticle->entityCount);
+    metricsSet(GAUGE_ENEMIES, archEnemy->entityCount);
 
     glutSwapBuffers();
-    // Keep rendering even on game over so overlay stays visible
-    glutPostRedisplay();
+    inputFramePresented();
+    if (startup.firstFrameMs == 0.0) {
+        startup.firstFrameMs = (preciseSeconds() - startup.begin) * 1000.0;
+        printf("First frame at %.1f ms: window %.1f ms, assets %.1f ms (%d of %d generated, %u KB mapped), lighting %.1f ms (%s, layout %s)\n",
+            startup.firstFrameMs, startup.windowMs, assets.ms, assets.generated, ASSET_COUNT,
+            (unsigned)(assetCache.mappedBytes / 1024), baked.ms, baked.fromCache ? "cached" : "baked", baked.layoutFromCache ? "cached" : "baked");
+    }
+    // Keep rendering even on game over so overlay stays visible (at the idle rate)
+    pacerFramePresented();
 }
 
 // Main
 int main(int argc, char** argv) {
-    srand((unsigned)time(NULL));
+    startup.begin = preciseSeconds();
+    gameRngState = (unsigned)time(NULL);
+    layoutSeed = gameRngState ^ 0x9E3779B9u;
+    for (int i = 1; i + 1 < argc; i++)
+        if (!strcmp(argv[i], "--bench-hits")) return benchHits(atoi(argv[i + 1]));
     glutInit(&argc, argv);
+    pacerInit();
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitWindowSize(WIN_W, WIN_H);
     glutCreateWindow("FPS OpenGL - Fixed Enemies & Gun");
+    startup.windowMs = (preciseSeconds() - startup.begin) * 1000.0;
+
+    const char* resume = 0;
+    bool fixedStep = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--fps") && i + 1 < argc) pacer.targetFps = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--idle-fps") && i + 1 < argc) pacer.idleFps = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--frame-budget") && i + 1 < argc) dynRes.budgetMs = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--no-dynres")) dynRes.enabled = false;
+        else if (!strcmp(argv[i], "--no-occlusion")) occlusion.enabled = false;
+        else if (!strcmp(argv[i], "--cache-dir") && i + 1 < argc) snprintf(assetCache.dir, sizeof(assetCache.dir), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--no-cache")) assetCache.enabled = false;
+        else if (!strcmp(argv[i], "--layout-seed") && i + 1 < argc) { layoutSeed = (unsigned)strtoul(argv[++i], 0, 10); baked.storeLayout = true; }
+        else if (!strcmp(argv[i], "--metrics-file") && i + 1 < argc) snprintf(metrics.file, sizeof(metrics.file), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--metrics-port") && i + 1 < argc) metrics.port = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--metrics-interval") && i + 1 < argc) metrics.interval = (float)atof(argv[++i]);
+        else if (!strcmp(argv[i], "--snapshot-every") && i + 1 < argc) snapshots.every = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc) snprintf(snapshots.checkpoint, sizeof(snapshots.checkpoint), "%s", argv[++i]);
+        else if (!strcmp(argv[i], "--resume") && i + 1 < argc) resume = argv[++i];
+        else if (!strcmp(argv[i], "--fixed-step")) fixedStep = true;
+    }
+    if (pacer.targetFps < 1.0f) pacer.targetFps = 1.0f;
+    if (pacer.idleFps < 1.0f) pacer.idleFps = 1.0f;
+    if (fixedStep) snapshots.fixedDt = 1.0f / pacer.targetFps;   // slow frames slow the game down
+    startMetrics();
 
     glEnable(GL_DEPTH_TEST);
     glShadeModel(GL_SMOOTH);
+    initRenderState();
 
     updateCameraVectors();
+    initModels();
+    initHitboxes();
+    unsigned cores = std::thread::hardware_concurrency();
+    initJobPool(cores > 1 ? (int)cores - 1 : 0);
+    initEntityTypes();
+    initSystems();
     initEnemies();
     initEnvironment();
+    loadAssets();
+    initTerrain(assets.terrain->verts);
+    bakeLighting();
+    uploadSkyTexture();
+    initSnapshots(resume);
 
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
     glutPassiveMotionFunc(passiveMouse);
+    glutMotionFunc(passiveMouse);
     glutKeyboardFunc(keyboardDown);
     glutKeyboardUpFunc(keyboardUp);
     glutSpecialFunc(specialDown);
     glutMouseFunc(mouseClick);
+    glutEntryFunc(entry);
+    glutWindowStatusFunc(windowStatus);
 
     if (cursorCaptured) {
         glutSetCursor(GLUT_CURSOR_NONE);
-        int cx = WIN_W / 2, cy = WIN_H / 2;
-        ignoreWarp = true;
-        glutWarpPointer(cx, cy);
+        warpPointerToCenter();
     }
 
-    lastTime = nowSeconds();
-    printf("Controls: WASD-move, Mouse LMB-shoot, SHIFT-run, R-reload, ESC-toggle cursor\n");
+    lastTime = gameSeconds();
+    printf("Controls: WASD-move, Mouse LMB-shoot, SHIFT-run, R-reload, ESC-toggle cursor, F3-stats, F4-dynamic resolution, F5-occlusion culling, F6-rewind, F7-save checkpoint, F8-restart\n");
     glutMainLoop();
     return 0;
 }
\ No newline at end of file